@@ -1,4 +1,4 @@
-const Database = require("better-sqlite3");
+const { Database } = require("../index.js");
 const fs = require("fs");
 
 // Clean up any existing test databases
@@ -12,11 +12,8 @@ if (fs.existsSync("benchmark-utf8.db")) {
 console.log("Setting up benchmark databases with 50,000 rows each...");
 
 function createDatabase(filename, useUtf16) {
-	const db = new Database(filename);
-	if (useUtf16) {
-		db.pragma(`encoding = "UTF-16"`);
-	}
-	db.pragma(`journal_mode = MEMORY`);
+	const db = new Database(filename, { encoding: useUtf16 ? "utf16" : "utf8" });
+	db.exec(`PRAGMA journal_mode = MEMORY`);
 	return db;
 }
 
@@ -32,12 +29,6 @@ function setupDatabase(db) {
 	// Insert data efficiently
 	const insert = db.prepare(`INSERT INTO users (name, email, description) VALUES (?, ?, ?)`);
 
-	const insertMany = db.transaction((users) => {
-		for (const user of users) {
-			insert.run(user);
-		}
-	});
-
 	// Generate test data
 	const users = [];
 	for (let i = 0; i < 50000; i++) {
@@ -48,7 +39,9 @@ function setupDatabase(db) {
 		]);
 	}
 
-	insertMany(users);
+	// One transaction for all rows
+	insert.runMany(users);
+	insert.finalize();
 	db.close();
 }
 
@@ -4,9 +4,23 @@
       "target_name": "mo_betta_sqlite3",
       "sources": [
         "src/addon.cpp",
+        "src/addon_data.cpp",
         "src/database.cpp",
         "src/statement.cpp",
+        "src/binder.cpp",
+        "src/columnar.cpp",
+        "src/row_buffer.cpp",
+        "src/async_work.cpp",
+        "src/statement_cache.cpp",
         "src/external_string.cpp",
+        "src/text_encoding.cpp",
+        "src/simd_text.cpp",
+        "src/string_interner.cpp",
+        "src/blob_arena.cpp",
+        "src/blob_handle.cpp",
+        "src/arrow_ipc.cpp",
+        "src/row_export.cpp",
+        "src/csv_import.cpp",
         "deps/sqlite3/sqlite3.c"
       ],
       "include_dirs": [
@@ -17,7 +31,7 @@
       "cflags_cc!": ["-fno-exceptions"],
       "cflags_cc": ["-std=c++20", "-O3"],
       "defines": [
-        "SQLITE_THREADSAFE=0",
+        "SQLITE_THREADSAFE=2",
         "SQLITE_ENABLE_COLUMN_METADATA",
         "SQLITE_OMIT_LOAD_EXTENSION",
         "SQLITE_ENABLE_JSON1"
@@ -2,13 +2,23 @@ declare module "mo-betta-sqlite3" {
   export class Database {
     /**
      * Create a new database connection.
-     * The database will automatically be set to UTF-16 encoding.
+     * Text is read and bound in the encoding the file stores it in.
      * @param filename Path to SQLite database file
+     * @param options Set `readonly` to open an existing file without write access,
+     * `statementCacheSize` to bound the prepared statement cache (default 128, 0 disables it),
+     * and `encoding` to choose how a new file stores text (default "utf16"; "auto" keeps
+     * SQLite's default, UTF-8). Existing files keep their encoding.
      */
-    constructor(filename: string);
+    constructor(filename: string, options?: DatabaseOptions);
 
     /**
-     * Prepare a SQL statement for execution
+     * Prepare a SQL statement for execution.
+     *
+     * The statement cache only holds idle statements: a statement comes
+     * back to it when its Statement is finalized (or garbage collected).
+     * While an earlier Statement for the same SQL is still alive, prepare()
+     * misses and compiles another one, so keep reusing one Statement, or
+     * finalize each one when done with it, to get cache hits.
      * @param sql SQL query string
      * @returns A prepared statement
      */
@@ -21,11 +31,176 @@ declare module "mo-betta-sqlite3" {
     exec(sql: string): void;
 
     /**
-     * Close the database connection
+     * Execute SQL on the libuv threadpool without blocking the event loop.
+     * Until the returned promise settles, synchronous calls on this
+     * database and its statements throw; other async calls are queued.
+     * @param sql SQL statement(s) to execute
+     */
+    execAsync(sql: string): Promise<void>;
+
+    /**
+     * Wrap a function so that each call runs inside a transaction. The
+     * transaction commits when the function returns and rolls back when it
+     * throws. Called inside another transaction, it uses a savepoint
+     * instead. Async work started by the function waits until the
+     * outermost transaction has finished, and synchronous calls keep
+     * working until then; the database can't be closed while it waits.
+     * @param fn The function to run; arguments and `this` are passed through
+     * @returns The wrapped function (BEGIN DEFERRED), with `.deferred`, `.immediate` and `.exclusive` variants
+     */
+    transaction<F extends (...args: any[]) => any>(fn: F): Transaction<F>;
+
+    /**
+     * Counters of the prepared statement cache. prepare() reuses an idle
+     * statement with the same SQL text when there is one; finalize()
+     * resets a statement and returns it to the cache. Statements that are
+     * still in use don't count as idle; see prepare().
+     */
+    cacheStats(): StatementCacheStats;
+
+    /**
+     * Open the BLOB in one cell for incremental I/O, so that large values
+     * are read and written in chunks instead of all at once.
+     * @param table Table name
+     * @param column Column name
+     * @param rowid Rowid of the row
+     * @param options Set `readonly` to open the BLOB without write access
+     */
+    openBlob(table: string, column: string, rowid: number | bigint, options?: { readonly?: boolean }): BlobHandle;
+
+    /**
+     * Insert the records of a CSV file (RFC 4180) into a table, in one
+     * transaction that is rolled back on any error. Parser threads split
+     * and convert the file in chunks while the connection inserts them in
+     * order on the libuv threadpool. Unquoted fields that are integers or
+     * reals in canonical form are bound as numbers, empty unquoted fields
+     * as NULL, and everything else as text, left to the column's affinity.
+     * @param path Path to the CSV file
+     * @param table Name of the table, which must exist
+     * @param options `delimiter` (default ","); `header` (default true) takes the
+     * column names from the first record, otherwise records fill the table's
+     * columns in order; `threads` sets the number of parser threads (default:
+     * one per spare core, up to 8)
+     * @returns A promise for the number of rows inserted
+     */
+    importCsv(path: string, table: string, options?: CsvImportOptions): Promise<number>;
+
+    /**
+     * Close the database connection. Statements that are still alive are
+     * finalized and open BLOBs closed; using them afterwards throws. Databases and statements
+     * that become unreachable are also released by the garbage collector.
      */
     close(): void;
   }
 
+  /**
+   * Options accepted by the Database constructor
+   */
+  export type DatabaseOptions = { readonly?: boolean; statementCacheSize?: number; encoding?: "auto" | "utf8" | "utf16" };
+
+  /**
+   * A function wrapped by Database.transaction()
+   */
+  export type Transaction<F extends (...args: any[]) => any> = {
+    (...args: Parameters<F>): ReturnType<F>;
+    deferred: Transaction<F>;
+    immediate: Transaction<F>;
+    exclusive: Transaction<F>;
+  };
+
+  /**
+   * Result of cacheStats(). `size` counts the idle statements held by the cache.
+   */
+  export type StatementCacheStats = { hits: number; misses: number; size: number; capacity: number };
+
+  /**
+   * An open BLOB, returned by Database.openBlob(). Its size is fixed: to
+   * write a value, first insert a zeroblob(n) of the final size. Changing
+   * the row in any other way makes further reads and writes throw.
+   */
+  export class BlobHandle {
+    /** Size of the BLOB in bytes */
+    size(): number;
+
+    /**
+     * Read into `target` starting at `offset`, stopping at the end of the BLOB
+     * @returns The number of bytes read
+     */
+    read(target: ArrayBufferView, offset?: number): number;
+
+    /**
+     * Write all of `source` at `offset`. Throws a RangeError if it would
+     * extend past the end of the BLOB.
+     */
+    write(source: ArrayBufferView, offset?: number): void;
+
+    /** Move to the same column of another row, keeping the handle open */
+    reopen(rowid: number | bigint): void;
+
+    /** Close the handle. Handles that become unreachable are also closed by the garbage collector. */
+    close(): void;
+
+    /**
+     * A Readable of the BLOB from `start` to its end, in chunks of
+     * `highWaterMark` bytes (default 64 KiB). Closes the handle when it
+     * ends unless `autoClose` is false.
+     */
+    createReadStream(options?: { start?: number; highWaterMark?: number; autoClose?: boolean }): import("stream").Readable;
+
+    /**
+     * A Writable that writes each chunk after the previous one, from
+     * `start`. Closes the handle when it finishes unless `autoClose` is
+     * false.
+     */
+    createWriteStream(options?: { start?: number; highWaterMark?: number; autoClose?: boolean }): import("stream").Writable;
+  }
+
+  /**
+   * A set of connections to one WAL-mode database: one writer and several
+   * read-only connections. Queries run on the libuv threadpool, each read
+   * on whichever read connection is free, so reads proceed in parallel
+   * with each other and with the writer.
+   */
+  export class Pool {
+    /**
+     * Open the writer, switch the file to WAL mode and open the readers.
+     * If any connection fails to open, the ones already opened are closed
+     * before the error is rethrown.
+     * @param filename Path to SQLite database file
+     * @param options `readers` is the number of read connections (default: one less than UV_THREADPOOL_SIZE, at most the number of cores),
+     * `encoding` is passed to the writer, which may create the file
+     */
+    constructor(filename: string, options?: { readers?: number; encoding?: DatabaseOptions["encoding"] });
+
+    /**
+     * Run a query on a free read connection
+     * @param sql SQL query string
+     * @param params Optional parameters, bound as with Statement.bind()
+     * @returns A promise for all rows of the result set
+     */
+    all(sql: string, ...params: BindParameter[]): Promise<Row[]>;
+
+    /**
+     * Run a statement on the writer. Writes run one at a time, in order.
+     * @param sql SQL statement
+     * @param params Optional parameters, bound as with Statement.bind()
+     * @returns A promise for the number of changed rows and the last inserted rowid
+     */
+    run(sql: string, ...params: BindParameter[]): Promise<RunResult>;
+
+    /**
+     * Execute SQL on the writer, queued with run()
+     * @param sql SQL statement(s) to execute
+     */
+    exec(sql: string): Promise<void>;
+
+    /**
+     * Let queued queries finish, then close every connection. Queries
+     * submitted after close() reject.
+     */
+    close(): Promise<void>;
+  }
+
   export class Statement implements Iterable<Row> {
     /**
      * Step to the next row in the result set
@@ -34,14 +209,209 @@ declare module "mo-betta-sqlite3" {
     step(): boolean;
 
     /**
-     * Get the value of a column in the current row
+     * Get the value of a column in the current row. A number or string
+     * always names a column; to bind parameters, pass them to the other
+     * overload as an array or object.
      * @param column Column index (0-based) or column name
      * @returns The column value (string values use zero-copy external strings)
      */
     get(column: number | string): ColumnValue;
 
     /**
-     * Finalize the statement and free resources
+     * Get a column of the current row as a 32-bit integer, converted like
+     * sqlite3_column_int64(). Throws a RangeError if the value does not fit
+     * in 32 bits. Together with step(), reset() and the other typed
+     * accessors this uses V8 fast API calls when the Node headers it was
+     * built against provide them.
+     * @param column Column index (0-based)
+     */
+    getInt(column: number): number;
+
+    /**
+     * Get a column of the current row as a double
+     * @param column Column index (0-based)
+     */
+    getDouble(column: number): number;
+
+    /**
+     * Bind a 32-bit integer to a parameter, keeping the other bindings
+     * @param index Parameter index (1-based, as in SQLite)
+     * @param value The value to bind
+     */
+    bindInt(index: number, value: number): void;
+
+    /**
+     * Bind a double to a parameter, keeping the other bindings
+     * @param index Parameter index (1-based, as in SQLite)
+     * @param value The value to bind
+     */
+    bindDouble(index: number, value: number): void;
+
+    /**
+     * Bind parameters, execute the statement and return the first row.
+     * Parameters must be wrapped: get([5]) binds 5, while get(5) reads
+     * column 5 of the current row.
+     * @param params Positional parameters as an array, or named parameters as an object
+     * @returns The first row, or undefined if the query returned no rows
+     */
+    get(params: BindParameters): Row | undefined;
+
+    /**
+     * Bind parameters to the statement. Later calls to step(), iteration,
+     * all(), get() and run() without parameters reuse these bindings.
+     * @param params Positional values, arrays of positional values or an object of named values
+     * @returns This statement
+     */
+    bind(...params: BindParameter[]): this;
+
+    /**
+     * Execute the statement and return every row
+     * @param params Optional parameters, bound as with bind()
+     * @returns All rows of the result set
+     */
+    all(...params: BindParameter[]): Row[];
+
+    /**
+     * Execute a statement that does not return rows
+     * @param params Optional parameters, bound as with bind()
+     * @returns The number of changed rows and the last inserted rowid
+     */
+    run(...params: BindParameter[]): RunResult;
+
+    /**
+     * Like all(), but steps the statement on the libuv threadpool and
+     * builds the rows on the main thread once the query has finished
+     * @param params Optional parameters, bound as with bind()
+     * @returns A promise for all rows of the result set
+     */
+    allAsync(...params: BindParameter[]): Promise<Row[]>;
+
+    /**
+     * Execute the statement once per element of `rows` in a single native
+     * call, inside a transaction (or a savepoint if one is already open).
+     * If any row fails, every row of the call is rolled back.
+     * @param rows One parameter set per execution, each bound like a single argument to run()
+     * @returns The total number of changed rows and the last inserted rowid after each row
+     */
+    runMany(rows: BindParameter[]): RunManyResult;
+
+    /**
+     * Execute the statement once per row of column-oriented data, inside a
+     * transaction like runMany(). Typed array columns are read directly
+     * from their memory; plain arrays may hold any bindable values.
+     * @param columns Columns bound positionally (array) or by parameter name (object)
+     * @param count Number of rows to insert (default: length of the shortest column)
+     * @returns The total number of changed rows and the last inserted rowid
+     */
+    runColumns(columns: ParameterColumn[] | { [name: string]: ParameterColumn }, count?: number): RunResult;
+
+    /**
+     * Like run(), but executes the statement on the libuv threadpool
+     * @param params Optional parameters, bound as with bind()
+     * @returns A promise for the number of changed rows and the last inserted rowid
+     */
+    runAsync(...params: BindParameter[]): Promise<RunResult>;
+
+    /**
+     * Write the rest of the result set to a file, formatted natively and
+     * flushed in large writes, without creating JS values for the rows.
+     * Integers and reals are written exactly, text as UTF-8, BLOBs as hex,
+     * and NULL as an empty CSV field or JSON null; empty text is written
+     * as "" in CSV. Uses the parameters currently bound.
+     *
+     * CSV has no way to mark NULL, so in a result with a single column a
+     * NULL row becomes an empty line. CSV readers, importCsv() included,
+     * skip empty lines, so those rows are lost when the file is read back.
+     * Export such results as NDJSON, or select a second column (or
+     * COALESCE the value) when the rows must survive.
+     * @param target A path, created or truncated, or an open file descriptor, left open
+     * @param options `format` is "csv" (default, RFC 4180 quoting) or "ndjson";
+     * `header` (default true) starts CSV output with the column names
+     * @returns The number of rows written
+     */
+    exportTo(target: number | string, options?: ExportOptions): number;
+
+    /**
+     * Like exportTo(), but steps and writes on the libuv threadpool
+     */
+    exportToAsync(target: number | string, options?: ExportOptions): Promise<number>;
+
+    /**
+     * Toggle raw mode. In raw mode rows are returned as arrays of values in
+     * column order instead of objects keyed by column name.
+     * @param toggle Whether raw mode is enabled (default true)
+     * @returns This statement
+     */
+    raw(toggle?: boolean): this;
+
+    /**
+     * Share one string between all cells of a text column that hold the
+     * same value, for labels like a status or country code. Interned strings
+     * are internalized, so comparing them is cheap. A column that shows more
+     * than `maxDistinct` values, or a value longer than 128 bytes, falls back
+     * to a new string per cell.
+     * @param options `false` turns interning off; `maxDistinct` defaults to 256
+     * @returns This statement
+     */
+    intern(options?: boolean | { maxDistinct?: number }): this;
+
+    /**
+     * Choose how BLOB values are returned. "buffer" (the default) copies each
+     * value into its own Buffer. The other modes copy the BLOBs of a batch
+     * (one call of all(), nextBatch() or get()) into shared 64 KiB
+     * ArrayBuffers: "slab" returns Buffer views, "uint8array",
+     * "float32array" and "float64array" return typed array views. A view
+     * keeps its whole ArrayBuffer alive and `.buffer` exposes the other
+     * values in it. A BLOB whose length isn't a whole number of floats comes
+     * back as a Uint8Array.
+     * @returns This statement
+     */
+    blobMode(mode: BlobMode): this;
+
+    /**
+     * Look up a result column by name once, to pass the index to get(),
+     * getInt() or getDouble() afterwards. With duplicate names the first
+     * column is returned; an unknown name throws a RangeError.
+     * @param name Column name
+     * @returns The 0-based column index
+     */
+    columnIndex(name: string): number;
+
+    /**
+     * Get the names of the result columns, in column order
+     * @returns The column names
+     */
+    columns(): string[];
+
+    /**
+     * Step up to maxRows rows natively and return them column by column in
+     * typed arrays, without creating a JS value per cell. Call repeatedly
+     * until `done` is true to scan the whole result set. A column's type
+     * comes from its declared type, or else from its first non-NULL value
+     * in the first batch. A value that the type can't hold without loss
+     * (other than integers in a real column) throws a TypeError, as do
+     * text in an INTEGER column or a mix of types in an expression; CAST
+     * such columns in the query.
+     * @param maxRows Maximum number of rows in this batch (default: all remaining rows)
+     * @param options Set `bigint` to return INTEGER columns as BigInt64Array instead of Float64Array
+     * @returns The batch of columns
+     */
+    fetchColumns(maxRows?: number, options?: { bigint?: boolean }): ColumnBatch;
+
+    /**
+     * Step the rest of the result set natively into Apache Arrow record
+     * batches, without creating a JS value per row. Column types follow
+     * fetchColumns(): INTEGER columns become Int64, REAL Float64, TEXT
+     * Utf8 and BLOB Binary, all nullable.
+     * @param options `batchRows` bounds the rows per record batch (default 65536)
+     * @returns The messages of an Arrow IPC stream (schema, record batches,
+     * end-of-stream marker); concatenated, they can be read by any Arrow reader
+     */
+    toArrow(options?: { batchRows?: number }): Buffer[];
+
+    /**
+     * Finalize the statement. Its handle goes back to the database's
+     * statement cache, reset and with its bindings cleared.
      */
     finalize(): void;
 
@@ -51,29 +421,143 @@ declare module "mo-betta-sqlite3" {
     reset(): void;
 
     /**
-     * Get an iterator for this statement
-     * @returns This statement as an iterator
+     * Get an iterator over the rows of this statement. Rows are fetched
+     * from the native side in batches; breaking out of the loop resets
+     * the statement.
+     * @returns An iterator over the result rows
+     */
+    iterate(): IterableIterator<Row>;
+
+    /**
+     * Iterator protocol implementation, same as iterate()
      */
-    iterate(): Iterator<Row>;
+    [Symbol.iterator](): IterableIterator<Row>;
 
     /**
-     * Iterator protocol implementation
+     * Iterate the rows without holding the event loop for the whole scan:
+     * rows are stepped 256 at a time, with a turn of the event loop
+     * between batches. Breaking out of the loop resets the statement.
      */
-    [Symbol.iterator](): Iterator<Row>;
+    [Symbol.asyncIterator](): AsyncIterableIterator<Row>;
 
     /**
-     * Iterator next method
+     * An object-mode Readable of the rows, stepped `batchSize` rows
+     * (default 256) at a time on later turns of the event loop. Stepping
+     * pauses while the consumer applies backpressure; destroying the
+     * stream early resets the statement. Use Readable.toWeb() for a web
+     * ReadableStream.
+     */
+    stream(options?: { batchSize?: number }): import("stream").Readable;
+
+    /**
+     * Step a single row
      */
     next(): IteratorResult<Row>;
+
+    /**
+     * Step up to n rows in one native call. A batch shorter than n means
+     * the result set is exhausted and the statement has been reset.
+     * @param n Maximum number of rows to return
+     * @returns The rows, or an empty array once the statement is exhausted
+     */
+    nextBatch(n: number): Row[];
   }
 
   /**
-   * Possible column value types
+   * Possible column value types. BLOBs are Buffers unless blobMode() picks
+   * a typed array.
+   */
+  export type ColumnValue = string | number | bigint | Buffer | Uint8Array | Float32Array | Float64Array | null;
+
+  /**
+   * How BLOB values are returned, see Statement.blobMode()
+   */
+  export type BlobMode = "buffer" | "slab" | "uint8array" | "float32array" | "float64array";
+
+  /**
+   * Values that can be bound to a statement parameter
+   */
+  export type BindValue = string | number | bigint | boolean | ArrayBufferView | null | undefined;
+
+  /**
+   * Positional parameters as an array, or named parameters (`:name`, `@name`, `$name`) as an object
+   */
+  export type BindParameters = BindValue[] | { [name: string]: BindValue };
+
+  /**
+   * A single argument accepted wherever parameters can be bound
+   */
+  export type BindParameter = BindValue | BindParameters;
+
+  /**
+   * Result of run()
    */
-  export type ColumnValue = string | number | bigint | Buffer | null;
+  export type RunResult = { changes: number | bigint; lastInsertRowid: number | bigint };
+
+  /**
+   * One parameter's values for runColumns(). Integer typed arrays bind as
+   * INTEGER, float arrays as REAL.
+   */
+  export type ParameterColumn =
+    | BindValue[]
+    | Float64Array
+    | Float32Array
+    | BigInt64Array
+    | BigUint64Array
+    | Int32Array
+    | Uint32Array
+    | Int16Array
+    | Uint16Array
+    | Int8Array
+    | Uint8Array
+    | Uint8ClampedArray;
+
+  /**
+   * Options of Database.importCsv()
+   */
+  export type CsvImportOptions = { delimiter?: string; header?: boolean; threads?: number };
+
+  /**
+   * Options of exportTo()
+   */
+  export type ExportOptions = { format?: "csv" | "ndjson"; header?: boolean };
+
+  /**
+   * Result of runMany()
+   */
+  export type RunManyResult = { changes: number | bigint; lastInsertRowids: BigInt64Array };
 
   /**
    * A row object with column names as keys and their values
    */
   export type Row = { [columnName: string]: ColumnValue };
+
+  /**
+   * One column of a fetchColumns() batch. Numeric columns carry `values`,
+   * text (UTF-8) and blob columns carry `offsets` (rowCount + 1 entries) into
+   * `data`. Bit i of `nulls` (least significant bit first) is set when row
+   * i is NULL.
+   */
+  export type ColumnData = {
+    name: string;
+    type: "integer" | "real" | "text" | "blob";
+    values?: Float64Array | BigInt64Array;
+    offsets?: Int32Array;
+    data?: Buffer;
+    nulls: Uint8Array;
+  };
+
+  /**
+   * Result of fetchColumns()
+   */
+  export type ColumnBatch = {
+    rowCount: number;
+    done: boolean;
+    columns: ColumnData[];
+  };
+
+  /**
+   * A row in raw mode, with values in column order
+   */
+  export type RawRow = ColumnValue[];
 }
@@ -1,3 +1,391 @@
+const os = require("os");
+const { Readable, Writable } = require("stream");
+const { setImmediate: yieldToEventLoop } = require("timers/promises");
 const moBettaSqlite3 = require('./build/Release/mo_betta_sqlite3.node');
 
+const { Database, Statement, BlobHandle } = moBettaSqlite3;
+
+// Iteration starts with small batches so that loops which stop early don't
+// step far ahead, then grows them to amortize the native calls.
+const INITIAL_BATCH_SIZE = 16;
+const MAX_BATCH_SIZE = 1024;
+
+class RowIterator {
+	constructor(statement) {
+		this.statement = statement;
+		this.rows = [];
+		this.index = 0;
+		this.batchSize = INITIAL_BATCH_SIZE;
+		this.exhausted = false;
+	}
+
+	next() {
+		if (this.index === this.rows.length) {
+			if (this.exhausted) {
+				return { value: undefined, done: true };
+			}
+			this.rows = this.statement.nextBatch(this.batchSize);
+			this.index = 0;
+			// A short batch means the statement reached the end and reset itself
+			if (this.rows.length < this.batchSize) {
+				this.exhausted = true;
+			}
+			if (this.batchSize < MAX_BATCH_SIZE) {
+				this.batchSize *= 2;
+			}
+			if (this.rows.length === 0) {
+				return { value: undefined, done: true };
+			}
+		}
+		return { value: this.rows[this.index++], done: false };
+	}
+
+	return() {
+		if (!this.exhausted) {
+			this.exhausted = true;
+			this.statement.reset();
+		}
+		this.rows = [];
+		this.index = 0;
+		return { value: undefined, done: true };
+	}
+
+	[Symbol.iterator]() {
+		return this;
+	}
+}
+
+Statement.prototype.iterate = function iterate() {
+	return new RowIterator(this);
+};
+
+Statement.prototype[Symbol.iterator] = Statement.prototype.iterate;
+
+// Rows handed out per native call by stream() and async iteration. Each
+// batch is stepped synchronously, so this bounds how long the event loop
+// is held at a time.
+const STREAM_BATCH_SIZE = 256;
+
+// Steps the next batch only when the consumer asks for it, after letting
+// the event loop run once
+class AsyncRowIterator {
+	constructor(statement, batchSize) {
+		this.statement = statement;
+		this.batchSize = batchSize;
+		this.rows = [];
+		this.index = 0;
+		this.exhausted = false;
+	}
+
+	async next() {
+		if (this.index === this.rows.length) {
+			if (this.exhausted) {
+				return { value: undefined, done: true };
+			}
+			await yieldToEventLoop();
+			// return() may have been called while waiting
+			if (this.exhausted) {
+				return { value: undefined, done: true };
+			}
+			this.rows = this.statement.nextBatch(this.batchSize);
+			this.index = 0;
+			if (this.rows.length < this.batchSize) {
+				this.exhausted = true;
+			}
+			if (this.rows.length === 0) {
+				return { value: undefined, done: true };
+			}
+		}
+		return { value: this.rows[this.index++], done: false };
+	}
+
+	async return() {
+		if (!this.exhausted) {
+			this.exhausted = true;
+			this.statement.reset();
+		}
+		this.rows = [];
+		this.index = 0;
+		return { value: undefined, done: true };
+	}
+
+	[Symbol.asyncIterator]() {
+		return this;
+	}
+}
+
+Statement.prototype[Symbol.asyncIterator] = function asyncIterator() {
+	return new AsyncRowIterator(this, STREAM_BATCH_SIZE);
+};
+
+// An object-mode Readable of the rows. A batch is stepped each time the
+// buffered rows drop below one batch, on a later turn of the event loop,
+// so a slow consumer pauses stepping. Destroying the stream early resets
+// the statement.
+Statement.prototype.stream = function stream(options = {}) {
+	const statement = this;
+	const batchSize = options.batchSize ?? STREAM_BATCH_SIZE;
+	if (!Number.isInteger(batchSize) || batchSize < 1) {
+		throw new RangeError("batchSize must be a positive integer");
+	}
+	let scheduled = false;
+	let exhausted = false;
+	return new Readable({
+		objectMode: true,
+		highWaterMark: batchSize,
+		read() {
+			if (scheduled) {
+				return;
+			}
+			scheduled = true;
+			setImmediate(() => {
+				scheduled = false;
+				if (this.destroyed) {
+					return;
+				}
+				let rows;
+				try {
+					rows = statement.nextBatch(batchSize);
+				} catch (error) {
+					exhausted = true;
+					this.destroy(error);
+					return;
+				}
+				for (const row of rows) {
+					this.push(row);
+				}
+				if (rows.length < batchSize) {
+					exhausted = true;
+					this.push(null);
+				}
+			});
+		},
+		destroy(error, callback) {
+			if (!exhausted) {
+				exhausted = true;
+				try {
+					statement.reset();
+				} catch (resetError) {
+					error = error ?? resetError;
+				}
+			}
+			callback(error);
+		},
+	});
+};
+
+// BLOB streams move this much per sqlite3_blob_read/sqlite3_blob_write call
+// unless told otherwise
+const BLOB_CHUNK_SIZE = 64 * 1024;
+
+// Streams the BLOB from `start` to its end, one chunk per read
+BlobHandle.prototype.createReadStream = function createReadStream(options = {}) {
+	const blob = this;
+	const chunkSize = options.highWaterMark ?? BLOB_CHUNK_SIZE;
+	let offset = options.start ?? 0;
+	return new Readable({
+		highWaterMark: chunkSize,
+		read(size) {
+			let chunk;
+			try {
+				const length = Math.min(chunkSize, blob.size() - offset);
+				if (length <= 0) {
+					this.push(null);
+					return;
+				}
+				chunk = Buffer.allocUnsafe(length);
+				offset += blob.read(chunk, offset);
+			} catch (error) {
+				this.destroy(error);
+				return;
+			}
+			this.push(chunk);
+		},
+		destroy(error, callback) {
+			if (options.autoClose !== false) {
+				try {
+					blob.close();
+				} catch (closeError) {
+					error = error ?? closeError;
+				}
+			}
+			callback(error);
+		},
+	});
+};
+
+// Writes the chunks one after the other from `start`. A BLOB can't grow,
+// so it must have been inserted at its final size, e.g. with zeroblob(n).
+BlobHandle.prototype.createWriteStream = function createWriteStream(options = {}) {
+	const blob = this;
+	let offset = options.start ?? 0;
+	return new Writable({
+		highWaterMark: options.highWaterMark ?? BLOB_CHUNK_SIZE,
+		write(chunk, encoding, callback) {
+			try {
+				blob.write(chunk, offset);
+			} catch (error) {
+				callback(error);
+				return;
+			}
+			offset += chunk.length;
+			callback();
+		},
+		destroy(error, callback) {
+			if (options.autoClose !== false) {
+				try {
+					blob.close();
+				} catch (closeError) {
+					error = error ?? closeError;
+				}
+			}
+			callback(error);
+		},
+	});
+};
+
+// A connection of a pool runs one query at a time, so that it is never busy
+// when the pool prepares the next statement on it.
+class PoolConnection {
+	constructor(database) {
+		this.database = database;
+		this.busy = false;
+	}
+
+	async run(task) {
+		this.busy = true;
+		try {
+			return await task(this.database);
+		} finally {
+			this.busy = false;
+		}
+	}
+}
+
+// How long a connection waits on a lock held by another one of the pool,
+// e.g. during a checkpoint, before failing with SQLITE_BUSY
+const BUSY_TIMEOUT_MS = 5000;
+
+// Every connection runs its queries on the libuv threadpool; leave one
+// thread to the writer so that reads never starve it.
+function defaultReaderCount() {
+	const threads = Number(process.env.UV_THREADPOOL_SIZE) || 4;
+	return Math.max(1, Math.min(os.availableParallelism(), threads - 1));
+}
+
+function queryAll(database, sql, params) {
+	const statement = database.prepare(sql);
+	return statement.allAsync(...params).finally(() => statement.finalize());
+}
+
+function queryRun(database, sql, params) {
+	const statement = database.prepare(sql);
+	return statement.runAsync(...params).finally(() => statement.finalize());
+}
+
+class Pool {
+	constructor(filename, options = {}) {
+		const readers = options.readers ?? defaultReaderCount();
+		if (!Number.isInteger(readers) || readers < 1) {
+			throw new RangeError("readers must be a positive integer");
+		}
+
+		// The writer creates the file and switches it to WAL, which lets the
+		// read-only connections run alongside it
+		const opened = [new Database(filename, { encoding: options.encoding })];
+		try {
+			const writer = opened[0];
+			writer.exec(`PRAGMA busy_timeout = ${BUSY_TIMEOUT_MS}`);
+			writer.exec("PRAGMA journal_mode = WAL");
+			for (let i = 0; i < readers; i++) {
+				const reader = new Database(filename, { readonly: true });
+				opened.push(reader);
+				reader.exec(`PRAGMA busy_timeout = ${BUSY_TIMEOUT_MS}`);
+			}
+		} catch (err) {
+			// Don't leave the connections opened so far to the garbage collector
+			for (const database of opened) {
+				database.close();
+			}
+			throw err;
+		}
+		this.writer = new PoolConnection(opened[0]);
+		this.readers = opened.slice(1).map((database) => new PoolConnection(database));
+
+		this.readQueue = [];
+		this.writeQueue = [];
+		this.closed = false;
+		this.closing = null;
+		this.onIdle = null;
+	}
+
+	// Reads go to the first free read connection
+	all(sql, ...params) {
+		return this.enqueue(this.readQueue, (database) => queryAll(database, sql, params));
+	}
+
+	// Writes run one at a time on the writer, in the order they were queued
+	run(sql, ...params) {
+		return this.enqueue(this.writeQueue, (database) => queryRun(database, sql, params));
+	}
+
+	exec(sql) {
+		return this.enqueue(this.writeQueue, (database) => database.execAsync(sql));
+	}
+
+	// Lets queued queries finish, then closes every connection
+	close() {
+		if (!this.closing) {
+			this.closed = true;
+			this.closing = new Promise((resolve) => {
+				this.onIdle = resolve;
+			}).then(() => {
+				for (const connection of this.connections()) {
+					connection.database.close();
+				}
+			});
+			this.dispatch();
+		}
+		return this.closing;
+	}
+
+	connections() {
+		return [this.writer, ...this.readers];
+	}
+
+	enqueue(queue, task) {
+		if (this.closed) {
+			return Promise.reject(new Error("Pool is closed"));
+		}
+		return new Promise((resolve, reject) => {
+			queue.push({ task, resolve, reject });
+			this.dispatch();
+		});
+	}
+
+	dispatch() {
+		if (!this.writer.busy && this.writeQueue.length > 0) {
+			this.start(this.writer, this.writeQueue.shift());
+		}
+		for (const reader of this.readers) {
+			if (this.readQueue.length === 0) {
+				break;
+			}
+			if (!reader.busy) {
+				this.start(reader, this.readQueue.shift());
+			}
+		}
+		if (this.onIdle && this.writeQueue.length === 0 && this.readQueue.length === 0 &&
+			!this.connections().some((connection) => connection.busy)) {
+			this.onIdle();
+		}
+	}
+
+	start(connection, { task, resolve, reject }) {
+		connection.run(task).then(resolve, reject).finally(() => this.dispatch());
+	}
+}
+
+moBettaSqlite3.Pool = Pool;
+
 module.exports = moBettaSqlite3;
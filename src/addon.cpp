@@ -1,14 +1,20 @@
 #include <node.h>
 #include <v8.h>
+#include "addon_data.h"
+#include "blob_handle.h"
 #include "database.h"
 #include "statement.h"
 
-using v8::Local;
-using v8::Object;
+using v8::Isolate;
 
-void InitAll(Local<Object> exports) {
-    Database::Init(exports);
-    Statement::Init(exports);
-}
+// Context-aware, so the addon can be loaded by several worker_threads
+NODE_MODULE_INIT() {
+    Isolate* isolate = context->GetIsolate();
+
+    AddonData* data = new AddonData(isolate);
+    data->cleanup_hook = node::AddEnvironmentCleanupHook(isolate, AddonData::Cleanup, data);
 
-NODE_MODULE(mo_betta_sqlite3, InitAll)
+    Database::Init(exports, data);
+    Statement::Init(exports, data);
+    BlobHandle::Init(exports, data);
+}
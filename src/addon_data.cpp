@@ -0,0 +1,74 @@
+#include "addon_data.h"
+#include "database.h"
+#include <string_view>
+
+using v8::DictionaryTemplate;
+using v8::External;
+using v8::FunctionCallbackInfo;
+using v8::Isolate;
+using v8::MemorySpan;
+using v8::NewStringType;
+using v8::String;
+using v8::Value;
+
+AddonData::AddonData(Isolate* isolate) {
+    const std::string_view iteratorResultKeys[] = {"value", "done"};
+    iterator_result_template.Reset(isolate, DictionaryTemplate::New(isolate,
+        MemorySpan<const std::string_view>(iteratorResultKeys, 2)));
+
+    const std::string_view runResultKeys[] = {"changes", "lastInsertRowid"};
+    run_result_template.Reset(isolate, DictionaryTemplate::New(isolate,
+        MemorySpan<const std::string_view>(runResultKeys, 2)));
+
+    const std::string_view runManyResultKeys[] = {"changes", "lastInsertRowids"};
+    run_many_result_template.Reset(isolate, DictionaryTemplate::New(isolate,
+        MemorySpan<const std::string_view>(runManyResultKeys, 2)));
+
+    bigint_string.Reset(isolate, String::NewFromUtf8(isolate, "bigint", NewStringType::kInternalized).ToLocalChecked());
+    readonly_string.Reset(isolate, String::NewFromUtf8(isolate, "readonly", NewStringType::kInternalized).ToLocalChecked());
+    statement_cache_size_string.Reset(isolate, String::NewFromUtf8(isolate, "statementCacheSize", NewStringType::kInternalized).ToLocalChecked());
+    encoding_string.Reset(isolate, String::NewFromUtf8(isolate, "encoding", NewStringType::kInternalized).ToLocalChecked());
+}
+
+AddonData::~AddonData() {
+    while (!databases.empty()) {
+        delete *databases.begin();
+    }
+    database_constructor.Reset();
+    statement_constructor.Reset();
+    blob_handle_constructor.Reset();
+    iterator_result_template.Reset();
+    run_result_template.Reset();
+    run_many_result_template.Reset();
+    bigint_string.Reset();
+    readonly_string.Reset();
+    statement_cache_size_string.Reset();
+    encoding_string.Reset();
+}
+
+AddonData* AddonData::From(const FunctionCallbackInfo<Value>& args) {
+    return static_cast<AddonData*>(args.Data().As<External>()->Value());
+}
+
+void AddonData::Cleanup(void* data, void (*done)(void*), void* done_data) {
+    AddonData* addon_data = static_cast<AddonData*>(data);
+    addon_data->tearing_down = true;
+    addon_data->cleanup_done_ = done;
+    addon_data->cleanup_done_data_ = done_data;
+    for (Database* db : addon_data->databases) {
+        db->CancelWork();
+    }
+    addon_data->WorkFinished();
+}
+
+void AddonData::WorkFinished() {
+    for (Database* db : databases) {
+        if (db->HasRunningWork()) {
+            return;
+        }
+    }
+    void (*done)(void*) = cleanup_done_;
+    void* done_data = cleanup_done_data_;
+    delete this;
+    done(done_data);
+}
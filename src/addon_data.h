@@ -0,0 +1,55 @@
+#pragma once
+
+#include <v8.h>
+#include <node.h>
+#include <unordered_set>
+
+class Database;
+
+// State owned by one instance of the addon. Every isolate that loads the
+// addon (the main thread and each worker_thread) gets its own copy, which
+// is freed by an environment cleanup hook when that isolate shuts down.
+struct AddonData {
+    explicit AddonData(v8::Isolate* isolate);
+    ~AddonData();
+
+    AddonData(const AddonData&) = delete;
+    AddonData& operator=(const AddonData&) = delete;
+
+    // Retrieves the instance passed as data to a function template
+    static AddonData* From(const v8::FunctionCallbackInfo<v8::Value>& args);
+
+    // Async environment cleanup hook. Drops queued work and interrupts
+    // running work, then waits for the threadpool to hand that work back
+    // before closing the databases and freeing the instance.
+    static void Cleanup(void* data, void (*done)(void*), void* done_data);
+    // Called by a database whose running work finished during teardown
+    void WorkFinished();
+
+    node::AsyncCleanupHookHandle cleanup_hook;
+    // Set once the environment is shutting down; work that finishes then
+    // is dropped without settling its promise
+    bool tearing_down = false;
+
+    // Live Database objects, closed and deleted when the isolate shuts down
+    std::unordered_set<Database*> databases;
+
+    v8::Global<v8::Function> database_constructor;
+    v8::Global<v8::Function> statement_constructor;
+    v8::Global<v8::Function> blob_handle_constructor;
+
+    // Shared shapes for objects returned on hot paths
+    v8::Global<v8::DictionaryTemplate> iterator_result_template;
+    v8::Global<v8::DictionaryTemplate> run_result_template;
+    v8::Global<v8::DictionaryTemplate> run_many_result_template;
+
+    // Interned option keys
+    v8::Global<v8::String> bigint_string;
+    v8::Global<v8::String> readonly_string;
+    v8::Global<v8::String> statement_cache_size_string;
+    v8::Global<v8::String> encoding_string;
+
+private:
+    void (*cleanup_done_)(void*) = nullptr;
+    void* cleanup_done_data_ = nullptr;
+};
@@ -0,0 +1,272 @@
+#include "arrow_ipc.h"
+#include <bit>
+#include <cstring>
+#include <initializer_list>
+
+// Values from the Arrow format's Schema.fbs and Message.fbs
+static constexpr int16_t kMetadataV5 = 4;
+static constexpr uint8_t kHeaderSchema = 1;
+static constexpr uint8_t kHeaderRecordBatch = 3;
+static constexpr uint8_t kTypeInt = 2;
+static constexpr uint8_t kTypeFloatingPoint = 3;
+static constexpr uint8_t kTypeBinary = 4;
+static constexpr uint8_t kTypeUtf8 = 5;
+static constexpr int16_t kPrecisionDouble = 2;
+
+static constexpr uint32_t kContinuation = 0xFFFFFFFF;
+
+// Lays out a flatbuffer front to back. Every object is written after the
+// one that refers to it, which is what lets offsets be unsigned, and is
+// linked to it once its position is known. Scalars are aligned to their
+// size from the start of the buffer, as verifiers expect.
+class FlatBufferWriter {
+public:
+    const std::vector<uint8_t>& Bytes() const { return bytes_; }
+
+    void Align(size_t alignment) {
+        while (bytes_.size() % alignment != 0) {
+            bytes_.push_back(0);
+        }
+    }
+
+    template <typename T>
+    size_t Append(T value) {
+        Align(sizeof(T));
+        size_t position = bytes_.size();
+        bytes_.resize(position + sizeof(T));
+        memcpy(bytes_.data() + position, &value, sizeof(T));
+        return position;
+    }
+
+    template <typename T>
+    void Set(size_t position, T value) {
+        memcpy(bytes_.data() + position, &value, sizeof(T));
+    }
+
+    // Points the offset field at `field` to the object at `target`
+    void Link(size_t field, size_t target) {
+        Set<uint32_t>(field, static_cast<uint32_t>(target - field));
+    }
+
+    // Writes a vtable and then a table with a zeroed field of sizes[id]
+    // bytes for each field id, or none when the size is 0. Stores where
+    // each field is in `fields` and returns the position of the table.
+    size_t Table(std::initializer_list<uint8_t> sizes, size_t* fields) {
+        Align(2);
+        size_t vtable = bytes_.size();
+        Append<uint16_t>(static_cast<uint16_t>(4 + 2 * sizes.size()));
+        Append<uint16_t>(0);
+        for (size_t i = 0; i < sizes.size(); i++) {
+            Append<uint16_t>(0);
+        }
+
+        Align(4);
+        size_t table = bytes_.size();
+        Append<int32_t>(static_cast<int32_t>(table - vtable));
+        size_t id = 0;
+        for (uint8_t size : sizes) {
+            if (size > 0) {
+                Align(size);
+                fields[id] = bytes_.size();
+                bytes_.resize(bytes_.size() + size);
+                Set<uint16_t>(vtable + 4 + 2 * id, static_cast<uint16_t>(fields[id] - table));
+            }
+            id++;
+        }
+        Set<uint16_t>(vtable + 2, static_cast<uint16_t>(bytes_.size() - table));
+        return table;
+    }
+
+    // Writes the length of a vector whose elements follow, aligned to
+    // `alignment`, and returns its position
+    size_t Vector(size_t length, size_t alignment) {
+        while ((bytes_.size() + 4) % alignment != 0) {
+            bytes_.push_back(0);
+        }
+        return Append<uint32_t>(static_cast<uint32_t>(length));
+    }
+
+    size_t String(const std::string& value) {
+        size_t position = Vector(value.size(), 4);
+        bytes_.insert(bytes_.end(), value.begin(), value.end());
+        bytes_.push_back(0);
+        return position;
+    }
+
+private:
+    std::vector<uint8_t> bytes_;
+};
+
+static size_t Padded(size_t length) {
+    return (length + 7) & ~static_cast<size_t>(7);
+}
+
+// Writes the root Message table and returns the position of its header
+// field, for the caller to link the header to
+static size_t WriteMessage(FlatBufferWriter& fb, uint8_t header_type, int64_t body_length) {
+    size_t root = fb.Append<uint32_t>(0);
+    size_t fields[4];
+    size_t message = fb.Table({2, 1, 4, 8}, fields);
+    fb.Link(root, message);
+    fb.Set<int16_t>(fields[0], kMetadataV5);
+    fb.Set<uint8_t>(fields[1], header_type);
+    fb.Set<int64_t>(fields[3], body_length);
+    return fields[2];
+}
+
+// Frames the metadata as an encapsulated message, with room for the body
+static std::vector<uint8_t> EncapsulateMessage(const FlatBufferWriter& fb, size_t body_length) {
+    const std::vector<uint8_t>& metadata = fb.Bytes();
+    uint32_t metadata_length = static_cast<uint32_t>(Padded(metadata.size()));
+
+    std::vector<uint8_t> message;
+    message.reserve(8 + metadata_length + body_length);
+    message.resize(8);
+    memcpy(message.data(), &kContinuation, 4);
+    memcpy(message.data() + 4, &metadata_length, 4);
+    message.insert(message.end(), metadata.begin(), metadata.end());
+    message.resize(8 + metadata_length);
+    return message;
+}
+
+std::vector<uint8_t> ArrowSchemaMessage(const std::vector<ColumnarBatch::Column>& columns,
+                                        const std::vector<std::string>& names) {
+    FlatBufferWriter fb;
+    size_t header = WriteMessage(fb, kHeaderSchema, 0);
+
+    // Endianness is left out, which means little-endian
+    size_t schema_fields[2];
+    size_t schema = fb.Table({0, 4}, schema_fields);
+    fb.Link(header, schema);
+
+    fb.Link(schema_fields[1], fb.Vector(columns.size(), 4));
+    std::vector<size_t> entries;
+    for (size_t i = 0; i < columns.size(); i++) {
+        entries.push_back(fb.Append<uint32_t>(0));
+    }
+
+    for (size_t i = 0; i < columns.size(); i++) {
+        size_t fields[6];
+        size_t field = fb.Table({4, 1, 1, 4, 0, 4}, fields);
+        fb.Link(entries[i], field);
+        fb.Set<uint8_t>(fields[1], 1);
+        fb.Link(fields[0], fb.String(names[i]));
+
+        size_t type_fields[2];
+        size_t type;
+        switch (columns[i].kind) {
+        case ColumnKind::Integer:
+            fb.Set<uint8_t>(fields[2], kTypeInt);
+            type = fb.Table({4, 1}, type_fields);
+            fb.Set<int32_t>(type_fields[0], 64);
+            fb.Set<uint8_t>(type_fields[1], 1);
+            break;
+        case ColumnKind::Real:
+            fb.Set<uint8_t>(fields[2], kTypeFloatingPoint);
+            type = fb.Table({2}, type_fields);
+            fb.Set<int16_t>(type_fields[0], kPrecisionDouble);
+            break;
+        case ColumnKind::Text:
+            fb.Set<uint8_t>(fields[2], kTypeUtf8);
+            type = fb.Table({}, type_fields);
+            break;
+        default:
+            fb.Set<uint8_t>(fields[2], kTypeBinary);
+            type = fb.Table({}, type_fields);
+            break;
+        }
+        fb.Link(fields[3], type);
+        // Readers require the children vector even when it is empty
+        fb.Link(fields[5], fb.Vector(0, 4));
+    }
+
+    return EncapsulateMessage(fb, 0);
+}
+
+// Arrow's validity bitmaps set the bit of each row that is not null
+static std::vector<uint8_t> ValidityBitmap(const std::vector<uint8_t>& nulls, size_t rows, int64_t* null_count) {
+    std::vector<uint8_t> validity(nulls.size());
+    *null_count = 0;
+    for (size_t i = 0; i < nulls.size(); i++) {
+        validity[i] = static_cast<uint8_t>(~nulls[i]);
+        *null_count += std::popcount(nulls[i]);
+    }
+    if (rows % 8 != 0) {
+        validity.back() &= static_cast<uint8_t>((1u << (rows % 8)) - 1);
+    }
+    return validity;
+}
+
+std::vector<uint8_t> ArrowRecordBatchMessage(const std::vector<ColumnarBatch::Column>& columns, size_t rows) {
+    struct BodyBuffer {
+        const void* data;
+        size_t length;
+    };
+
+    std::vector<int64_t> null_counts(columns.size());
+    std::vector<std::vector<uint8_t>> validity(columns.size());
+    std::vector<BodyBuffer> buffers;
+    for (size_t i = 0; i < columns.size(); i++) {
+        const ColumnarBatch::Column& column = columns[i];
+        // The null bits past the last row are always clear
+        validity[i] = ValidityBitmap(column.nulls, rows, &null_counts[i]);
+        if (null_counts[i] == 0) {
+            buffers.push_back({nullptr, 0});
+        } else {
+            buffers.push_back({validity[i].data(), validity[i].size()});
+        }
+
+        switch (column.kind) {
+        case ColumnKind::Integer:
+            buffers.push_back({column.ints.data(), rows * sizeof(int64_t)});
+            break;
+        case ColumnKind::Real:
+            buffers.push_back({column.doubles.data(), rows * sizeof(double)});
+            break;
+        default:
+            buffers.push_back({column.offsets.data(), (rows + 1) * sizeof(int32_t)});
+            buffers.push_back({column.data.data(), column.data.size()});
+            break;
+        }
+    }
+
+    size_t body_length = 0;
+    for (const BodyBuffer& buffer : buffers) {
+        body_length += Padded(buffer.length);
+    }
+
+    FlatBufferWriter fb;
+    size_t header = WriteMessage(fb, kHeaderRecordBatch, static_cast<int64_t>(body_length));
+    size_t fields[3];
+    size_t batch = fb.Table({8, 4, 4}, fields);
+    fb.Link(header, batch);
+    fb.Set<int64_t>(fields[0], static_cast<int64_t>(rows));
+
+    fb.Link(fields[1], fb.Vector(columns.size(), 8));
+    for (size_t i = 0; i < columns.size(); i++) {
+        fb.Append<int64_t>(static_cast<int64_t>(rows));
+        fb.Append<int64_t>(null_counts[i]);
+    }
+
+    fb.Link(fields[2], fb.Vector(buffers.size(), 8));
+    size_t offset = 0;
+    for (const BodyBuffer& buffer : buffers) {
+        fb.Append<int64_t>(static_cast<int64_t>(offset));
+        fb.Append<int64_t>(static_cast<int64_t>(buffer.length));
+        offset += Padded(buffer.length);
+    }
+
+    std::vector<uint8_t> message = EncapsulateMessage(fb, body_length);
+    for (const BodyBuffer& buffer : buffers) {
+        const uint8_t* data = static_cast<const uint8_t*>(buffer.data);
+        message.insert(message.end(), data, data + buffer.length);
+        message.resize(Padded(message.size()));
+    }
+    return message;
+}
+
+std::vector<uint8_t> ArrowEndOfStream() {
+    std::vector<uint8_t> message(8, 0);
+    memcpy(message.data(), &kContinuation, 4);
+    return message;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "columnar.h"
+
+// Encodes result sets as Arrow IPC stream messages
+// (https://arrow.apache.org/docs/format/Columnar.html#serialization-and-interprocess-communication-ipc).
+// The messages are written in order and concatenated form a stream that
+// Arrow readers accept. Integer columns become Int64, real columns
+// Float64, text Utf8 and blobs Binary, all nullable.
+
+// The Schema message that starts the stream
+std::vector<uint8_t> ArrowSchemaMessage(const std::vector<ColumnarBatch::Column>& columns,
+                                        const std::vector<std::string>& names);
+
+// A RecordBatch message with the rows of a batch created with `bigint`,
+// so that integers are held as int64
+std::vector<uint8_t> ArrowRecordBatchMessage(const std::vector<ColumnarBatch::Column>& columns, size_t rows);
+
+// The marker that ends the stream
+std::vector<uint8_t> ArrowEndOfStream();
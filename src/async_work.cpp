@@ -0,0 +1,107 @@
+#include "async_work.h"
+#include "addon_data.h"
+#include "database.h"
+
+using v8::Context;
+using v8::Exception;
+using v8::HandleScope;
+using v8::Isolate;
+using v8::Local;
+using v8::NewStringType;
+using v8::Object;
+using v8::Promise;
+using v8::String;
+using v8::TryCatch;
+using v8::Value;
+
+AsyncWork::AsyncWork(Isolate* isolate, Database* db, Local<Object> owner, const char* name)
+    : isolate_(isolate), db_(db) {
+    Local<Context> context = isolate->GetCurrentContext();
+
+    owner_.Reset(isolate, owner);
+    database_.Reset(isolate, db->handle_.Get(isolate));
+    context_.Reset(isolate, context);
+    resolver_.Reset(isolate, Promise::Resolver::New(context).ToLocalChecked());
+    async_context_ = node::EmitAsyncInit(isolate, owner, name);
+    request_.data = this;
+}
+
+AsyncWork::~AsyncWork() {
+    // Emitting the destroy hook needs a context, which teardown doesn't enter
+    HandleScope scope(isolate_);
+    Context::Scope context_scope(context_.Get(isolate_));
+    node::EmitAsyncDestroy(isolate_, async_context_);
+    owner_.Reset();
+    database_.Reset();
+    context_.Reset();
+    resolver_.Reset();
+}
+
+Local<Promise> AsyncWork::GetPromise(Isolate* isolate) {
+    return resolver_.Get(isolate)->GetPromise();
+}
+
+bool AsyncWork::Start() {
+    HandleScope scope(isolate_);
+    Context::Scope context_scope(context_.Get(isolate_));
+
+    TryCatch try_catch(isolate_);
+    if (!Setup(isolate_)) {
+        Settle(try_catch.Exception(), true);
+        return false;
+    }
+
+    uv_queue_work(node::GetCurrentEventLoop(isolate_), &request_, ExecuteWork, AfterWork);
+    return true;
+}
+
+void AsyncWork::Cancel() {
+    uv_cancel(reinterpret_cast<uv_req_t*>(&request_));
+}
+
+void AsyncWork::ExecuteWork(uv_work_t* request) {
+    static_cast<AsyncWork*>(request->data)->Execute();
+}
+
+void AsyncWork::AfterWork(uv_work_t* request, int status) {
+    AsyncWork* work = static_cast<AsyncWork*>(request->data);
+    Isolate* isolate = work->isolate_;
+
+    // Once the environment is shutting down no JS may run, so the promise
+    // is left unsettled; the work only hands the connection back
+    if (work->db_->GetAddonData()->tearing_down) {
+        work->db_->FinishWork(work);
+        return;
+    }
+
+    HandleScope scope(isolate);
+    Context::Scope context_scope(work->context_.Get(isolate));
+    // Runs the promise reactions once the work has settled
+    node::CallbackScope callback_scope(isolate, work->owner_.Get(isolate), work->async_context_);
+
+    if (!work->error_.empty()) {
+        work->Settle(Exception::Error(
+            String::NewFromUtf8(isolate, work->error_.c_str(), NewStringType::kNormal).ToLocalChecked()), true);
+    } else {
+        TryCatch try_catch(isolate);
+        Local<Value> result = work->Complete(isolate);
+        if (try_catch.HasCaught()) {
+            work->Settle(try_catch.Exception(), true);
+        } else {
+            work->Settle(result, false);
+        }
+    }
+
+    work->db_->FinishWork(work);
+}
+
+void AsyncWork::Settle(Local<Value> value, bool rejected) {
+    Local<Context> context = context_.Get(isolate_);
+    Local<Promise::Resolver> resolver = resolver_.Get(isolate_);
+
+    if (rejected) {
+        resolver->Reject(context, value).Check();
+    } else {
+        resolver->Resolve(context, value).Check();
+    }
+}
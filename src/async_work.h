@@ -0,0 +1,64 @@
+#pragma once
+
+#include <v8.h>
+#include <node.h>
+#include <uv.h>
+#include <string>
+
+class Database;
+
+// A query that runs against a connection on the libuv threadpool and
+// settles a promise on the main thread.
+//
+// Work is queued per Database, which runs one item at a time: Setup() and
+// Complete() run on the main thread, Execute() on a threadpool thread while
+// the connection is reserved for it.
+class AsyncWork {
+public:
+    AsyncWork(v8::Isolate* isolate, Database* db, v8::Local<v8::Object> owner, const char* name);
+    virtual ~AsyncWork();
+
+    AsyncWork(const AsyncWork&) = delete;
+    AsyncWork& operator=(const AsyncWork&) = delete;
+
+    v8::Local<v8::Promise> GetPromise(v8::Isolate* isolate);
+
+    // Runs Setup() and hands the work to the threadpool; rejects the
+    // promise instead if Setup() throws. Returns false if the work was
+    // settled and deleted without being queued.
+    bool Start();
+
+    // Takes the work off the threadpool queue if no thread has picked it up
+    // yet. It still completes through AfterWork either way.
+    void Cancel();
+
+protected:
+    // Main thread, right before Execute(). Returns false with a pending
+    // exception to reject the promise.
+    virtual bool Setup(v8::Isolate* isolate) { return true; }
+
+    // Threadpool thread; must not touch V8. Sets error_ on failure.
+    virtual void Execute() = 0;
+
+    // Main thread; returns the value the promise resolves with
+    virtual v8::Local<v8::Value> Complete(v8::Isolate* isolate) = 0;
+
+    v8::Isolate* isolate_;
+    Database* db_;
+    std::string error_;
+
+private:
+    static void ExecuteWork(uv_work_t* request);
+    static void AfterWork(uv_work_t* request, int status);
+
+    void Settle(v8::Local<v8::Value> value, bool rejected);
+
+    uv_work_t request_;
+    // Keeps the object the work belongs to alive until it settles, and the
+    // Database, whose connection the work uses, until it has finished
+    v8::Global<v8::Object> owner_;
+    v8::Global<v8::Object> database_;
+    v8::Global<v8::Context> context_;
+    v8::Global<v8::Promise::Resolver> resolver_;
+    node::async_context async_context_;
+};
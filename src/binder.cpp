@@ -0,0 +1,397 @@
+#include "binder.h"
+#include <string>
+
+using v8::Array;
+using v8::ArrayBuffer;
+using v8::ArrayBufferView;
+using v8::BigInt;
+using v8::Context;
+using v8::Exception;
+using v8::HandleScope;
+using v8::Isolate;
+using v8::Local;
+using v8::NewStringType;
+using v8::Object;
+using v8::String;
+using v8::TypedArray;
+using v8::Value;
+
+ParameterBinder::~ParameterBinder() {
+    for (auto& param : named_parameters_) {
+        param.key.Reset();
+    }
+}
+
+static bool IsNamedParameterObject(Local<Value> value) {
+    return value->IsObject() && !value->IsArray() && !value->IsArrayBufferView() &&
+           !value->IsArrayBuffer() && !value->IsDate();
+}
+
+bool ParameterBinder::IsParameterList(Local<Value> value) {
+    return value->IsArray() || IsNamedParameterObject(value);
+}
+
+static bool ThrowBindError(Isolate* isolate, sqlite3_stmt* stmt, int rc) {
+    if (rc == SQLITE_RANGE) {
+        isolate->ThrowException(Exception::RangeError(
+            String::NewFromUtf8(isolate, "Too many parameter values were provided", NewStringType::kNormal).ToLocalChecked()));
+    } else {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, sqlite3_errmsg(sqlite3_db_handle(stmt)), NewStringType::kNormal).ToLocalChecked()));
+    }
+    return false;
+}
+
+// Hands the string to SQLite in the connection's encoding so that it is
+// stored without another conversion
+static int BindString(Isolate* isolate, sqlite3_stmt* stmt, int index, Local<String> str, TextEncoding encoding) {
+    if (encoding == TextEncoding::Utf8) {
+        int bytes = str->Utf8Length(isolate);
+        char* utf8 = static_cast<char*>(sqlite3_malloc(bytes > 0 ? bytes : 1));
+        if (!utf8) {
+            return SQLITE_NOMEM;
+        }
+        str->WriteUtf8(isolate, utf8, bytes, nullptr, String::NO_NULL_TERMINATION);
+        return sqlite3_bind_text(stmt, index, utf8, bytes, sqlite3_free);
+    }
+
+    // Two-byte strings are copied as they are and one-byte strings only
+    // need widening, which is cheaper than SQLite transcoding UTF-8
+    int length = str->Length();
+    uint16_t* utf16 = static_cast<uint16_t*>(sqlite3_malloc64(length > 0 ? static_cast<sqlite3_uint64>(length) * 2 : 2));
+    if (!utf16) {
+        return SQLITE_NOMEM;
+    }
+    str->Write(isolate, utf16, 0, length, String::NO_NULL_TERMINATION);
+    return sqlite3_bind_text16(stmt, index, utf16, length * 2, sqlite3_free);
+}
+
+bool ParameterBinder::BindValue(Isolate* isolate, sqlite3_stmt* stmt, int index, Local<Value> value,
+                                TextEncoding encoding) {
+    int rc;
+
+    if (value->IsInt32()) {
+        rc = sqlite3_bind_int(stmt, index, value.As<v8::Int32>()->Value());
+    } else if (value->IsNumber()) {
+        rc = sqlite3_bind_double(stmt, index, value.As<v8::Number>()->Value());
+    } else if (value->IsString()) {
+        rc = BindString(isolate, stmt, index, value.As<String>(), encoding);
+    } else if (value->IsBigInt()) {
+        bool lossless;
+        int64_t ival = value.As<BigInt>()->Int64Value(&lossless);
+        if (!lossless) {
+            isolate->ThrowException(Exception::RangeError(
+                String::NewFromUtf8(isolate, "BigInt value is too large to be bound", NewStringType::kNormal).ToLocalChecked()));
+            return false;
+        }
+        rc = sqlite3_bind_int64(stmt, index, ival);
+    } else if (value->IsNull() || value->IsUndefined()) {
+        rc = sqlite3_bind_null(stmt, index);
+    } else if (value->IsArrayBufferView()) {
+        Local<ArrayBufferView> view = value.As<ArrayBufferView>();
+        size_t length = view->ByteLength();
+        const char* data = length == 0 ? "" : static_cast<const char*>(view->Buffer()->Data()) + view->ByteOffset();
+        rc = sqlite3_bind_blob64(stmt, index, data, length, SQLITE_TRANSIENT);
+    } else if (value->IsBoolean()) {
+        rc = sqlite3_bind_int(stmt, index, value->IsTrue() ? 1 : 0);
+    } else {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate,
+                "Parameters can only be numbers, bigints, strings, buffers, booleans or null",
+                NewStringType::kNormal).ToLocalChecked()));
+        return false;
+    }
+
+    if (rc != SQLITE_OK) {
+        return ThrowBindError(isolate, stmt, rc);
+    }
+    return true;
+}
+
+bool ParameterBinder::Bind(Isolate* isolate, sqlite3_stmt* stmt, const Local<Value>* values, int count) {
+    Local<Context> context = isolate->GetCurrentContext();
+
+    sqlite3_clear_bindings(stmt);
+
+    int position = 1;
+    for (int i = 0; i < count; i++) {
+        Local<Value> value = values[i];
+
+        if (value->IsArray()) {
+            Local<Array> array = value.As<Array>();
+            uint32_t length = array->Length();
+            for (uint32_t j = 0; j < length; j++) {
+                Local<Value> element;
+                if (!array->Get(context, j).ToLocal(&element)) {
+                    return false;
+                }
+                if (!BindValue(isolate, stmt, position++, element, encoding_)) {
+                    return false;
+                }
+            }
+        } else if (IsNamedParameterObject(value)) {
+            if (!BindNamed(isolate, stmt, value.As<Object>())) {
+                return false;
+            }
+        } else if (!BindValue(isolate, stmt, position++, value, encoding_)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const std::vector<ParameterBinder::NamedParameter>& ParameterBinder::NamedParameters(Isolate* isolate, sqlite3_stmt* stmt) {
+    if (!named_parameters_initialized_) {
+        InitializeNamedParameters(isolate, stmt);
+    }
+    return named_parameters_;
+}
+
+static void ThrowMissingParameter(Isolate* isolate, sqlite3_stmt* stmt, int index) {
+    std::string error = "Missing named parameter \"";
+    error += sqlite3_bind_parameter_name(stmt, index) + 1;
+    error += "\"";
+    isolate->ThrowException(Exception::RangeError(
+        String::NewFromUtf8(isolate, error.c_str(), NewStringType::kNormal).ToLocalChecked()));
+}
+
+bool ParameterBinder::BindNamed(Isolate* isolate, sqlite3_stmt* stmt, Local<Object> object) {
+    Local<Context> context = isolate->GetCurrentContext();
+
+    for (const auto& param : NamedParameters(isolate, stmt)) {
+        Local<String> key = param.key.Get(isolate);
+        Local<Value> value;
+        if (!object->Get(context, key).ToLocal(&value)) {
+            return false;
+        }
+
+        if (value->IsUndefined() && !object->Has(context, key).FromMaybe(false)) {
+            ThrowMissingParameter(isolate, stmt, param.index);
+            return false;
+        }
+
+        if (!BindValue(isolate, stmt, param.index, value, encoding_)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ParameterBinder::InitializeNamedParameters(Isolate* isolate, sqlite3_stmt* stmt) {
+    int paramCount = sqlite3_bind_parameter_count(stmt);
+
+    for (int i = 1; i <= paramCount; i++) {
+        const char* name = sqlite3_bind_parameter_name(stmt, i);
+        // Anonymous and numbered (?NNN) parameters can only be bound by position
+        if (!name || name[0] == '?') {
+            continue;
+        }
+
+        Local<String> key = String::NewFromUtf8(isolate, name + 1, NewStringType::kInternalized).ToLocalChecked();
+        named_parameters_.push_back({i, v8::Global<String>(isolate, key)});
+    }
+
+    named_parameters_initialized_ = true;
+}
+
+bool ParameterColumns::Init(Isolate* isolate, sqlite3_stmt* stmt, ParameterBinder& binder, Local<Value> columns) {
+    Local<Context> context = isolate->GetCurrentContext();
+    encoding_ = binder.Encoding();
+
+    if (columns->IsArray()) {
+        Local<Array> array = columns.As<Array>();
+        uint32_t length = array->Length();
+        if (length > static_cast<uint32_t>(sqlite3_bind_parameter_count(stmt))) {
+            return ThrowBindError(isolate, stmt, SQLITE_RANGE);
+        }
+        for (uint32_t i = 0; i < length; i++) {
+            Local<Value> column;
+            if (!array->Get(context, i).ToLocal(&column) || !AddColumn(isolate, static_cast<int>(i) + 1, column)) {
+                return false;
+            }
+        }
+        CaptureTypedColumns();
+        return true;
+    }
+
+    if (!IsNamedParameterObject(columns)) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Columns must be an array or an object of arrays", NewStringType::kNormal).ToLocalChecked()));
+        return false;
+    }
+
+    Local<Object> object = columns.As<Object>();
+    for (const auto& param : binder.NamedParameters(isolate, stmt)) {
+        Local<String> key = param.key.Get(isolate);
+        Local<Value> column;
+        if (!object->Get(context, key).ToLocal(&column)) {
+            return false;
+        }
+        if (column->IsUndefined() && !object->Has(context, key).FromMaybe(false)) {
+            ThrowMissingParameter(isolate, stmt, param.index);
+            return false;
+        }
+        if (!AddColumn(isolate, param.index, column)) {
+            return false;
+        }
+    }
+    CaptureTypedColumns();
+    return true;
+}
+
+bool ParameterColumns::AddColumn(Isolate* isolate, int index, Local<Value> column) {
+    Column entry{index, Kind::Values, nullptr, Local<Array>(), Local<TypedArray>()};
+
+    if (column->IsArray()) {
+        entry.values = column.As<Array>();
+        uint32_t length = entry.values->Length();
+        if (length < row_count_) {
+            row_count_ = length;
+        }
+        has_values_ = true;
+    } else if (column->IsTypedArray()) {
+        if (column->IsFloat64Array()) {
+            entry.kind = Kind::Float64;
+        } else if (column->IsFloat32Array()) {
+            entry.kind = Kind::Float32;
+        } else if (column->IsBigInt64Array()) {
+            entry.kind = Kind::BigInt64;
+        } else if (column->IsBigUint64Array()) {
+            entry.kind = Kind::BigUint64;
+        } else if (column->IsInt32Array()) {
+            entry.kind = Kind::Int32;
+        } else if (column->IsUint32Array()) {
+            entry.kind = Kind::Uint32;
+        } else if (column->IsInt16Array()) {
+            entry.kind = Kind::Int16;
+        } else if (column->IsUint16Array()) {
+            entry.kind = Kind::Uint16;
+        } else if (column->IsInt8Array()) {
+            entry.kind = Kind::Int8;
+        } else if (column->IsUint8Array() || column->IsUint8ClampedArray()) {
+            entry.kind = Kind::Uint8;
+        } else {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "Unsupported typed array column", NewStringType::kNormal).ToLocalChecked()));
+            return false;
+        }
+        entry.typed = column.As<TypedArray>();
+    } else {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Each column must be an array or a typed array", NewStringType::kNormal).ToLocalChecked()));
+        return false;
+    }
+
+    columns_.push_back(entry);
+    return true;
+}
+
+void ParameterColumns::CaptureTypedColumns() {
+    for (auto& column : columns_) {
+        if (column.kind == Kind::Values) {
+            continue;
+        }
+        size_t elements = column.typed->Length();
+        uint32_t length = elements > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(elements);
+        column.data = elements == 0 ? nullptr : static_cast<const char*>(column.typed->Buffer()->Data()) + column.typed->ByteOffset();
+        if (length < row_count_) {
+            row_count_ = length;
+        }
+    }
+}
+
+bool ParameterColumns::RecaptureTypedColumns(Isolate* isolate, uint32_t row) {
+    HandleScope scope(isolate);
+    for (auto& column : columns_) {
+        if (column.kind == Kind::Values) {
+            continue;
+        }
+        // A detached buffer reports a length of 0
+        if (column.typed->Length() <= row) {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "A typed array column was detached or shrunk while binding", NewStringType::kNormal)
+                    .ToLocalChecked()));
+            return false;
+        }
+        column.data = static_cast<const char*>(column.typed->Buffer()->Data()) + column.typed->ByteOffset();
+    }
+    return true;
+}
+
+template <typename T>
+static inline T ElementAt(const void* data, uint32_t row) {
+    return static_cast<const T*>(data)[row];
+}
+
+bool ParameterColumns::BindRow(Isolate* isolate, sqlite3_stmt* stmt, uint32_t row) {
+    if (has_values_) {
+        HandleScope scope(isolate);
+        Local<Context> context = isolate->GetCurrentContext();
+        for (const auto& column : columns_) {
+            if (column.kind != Kind::Values) {
+                continue;
+            }
+            Local<Value> value;
+            if (!column.values->Get(context, row).ToLocal(&value) ||
+                !ParameterBinder::BindValue(isolate, stmt, column.index, value, encoding_)) {
+                return false;
+            }
+        }
+        if (!RecaptureTypedColumns(isolate, row)) {
+            return false;
+        }
+    }
+
+    for (const auto& column : columns_) {
+        int rc;
+        switch (column.kind) {
+        case Kind::Float64:
+            rc = sqlite3_bind_double(stmt, column.index, ElementAt<double>(column.data, row));
+            break;
+        case Kind::Float32:
+            rc = sqlite3_bind_double(stmt, column.index, ElementAt<float>(column.data, row));
+            break;
+        case Kind::BigInt64:
+            rc = sqlite3_bind_int64(stmt, column.index, ElementAt<int64_t>(column.data, row));
+            break;
+        case Kind::BigUint64: {
+            uint64_t value = ElementAt<uint64_t>(column.data, row);
+            if (value > static_cast<uint64_t>(INT64_MAX)) {
+                isolate->ThrowException(Exception::RangeError(
+                    String::NewFromUtf8(isolate, "BigInt value is too large to be bound", NewStringType::kNormal).ToLocalChecked()));
+                return false;
+            }
+            rc = sqlite3_bind_int64(stmt, column.index, static_cast<sqlite3_int64>(value));
+            break;
+        }
+        case Kind::Int32:
+            rc = sqlite3_bind_int(stmt, column.index, ElementAt<int32_t>(column.data, row));
+            break;
+        case Kind::Uint32:
+            rc = sqlite3_bind_int64(stmt, column.index, ElementAt<uint32_t>(column.data, row));
+            break;
+        case Kind::Int16:
+            rc = sqlite3_bind_int(stmt, column.index, ElementAt<int16_t>(column.data, row));
+            break;
+        case Kind::Uint16:
+            rc = sqlite3_bind_int(stmt, column.index, ElementAt<uint16_t>(column.data, row));
+            break;
+        case Kind::Int8:
+            rc = sqlite3_bind_int(stmt, column.index, ElementAt<int8_t>(column.data, row));
+            break;
+        case Kind::Uint8:
+            rc = sqlite3_bind_int(stmt, column.index, ElementAt<uint8_t>(column.data, row));
+            break;
+        default:
+            // Bound above
+            continue;
+        }
+
+        if (rc != SQLITE_OK) {
+            return ThrowBindError(isolate, stmt, rc);
+        }
+    }
+    return true;
+}
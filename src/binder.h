@@ -0,0 +1,103 @@
+#pragma once
+
+#include <v8.h>
+#include <sqlite3.h>
+#include <cstdint>
+#include <vector>
+#include "text_encoding.h"
+
+// Maps JS values onto the parameters of a prepared statement.
+//
+// Arguments follow the same shapes everywhere a statement accepts
+// parameters: scalars and arrays bind positionally, a plain object binds
+// by name (`:name`, `@name` or `$name` in the SQL).
+class ParameterBinder {
+public:
+    // Strings are bound in `encoding`, the one the connection stores text in
+    explicit ParameterBinder(TextEncoding encoding) : encoding_(encoding) {}
+    ~ParameterBinder();
+
+    // Clears the current bindings and binds `values`. Returns false with a
+    // pending exception on the isolate if a value could not be bound.
+    bool Bind(v8::Isolate* isolate, sqlite3_stmt* stmt, const v8::Local<v8::Value>* values, int count);
+
+    // True for arrays and plain objects, which always carry parameters,
+    // as opposed to scalars that can also be a column index or name.
+    static bool IsParameterList(v8::Local<v8::Value> value);
+
+    // Binds a single value to the 1-based parameter `index`.
+    static bool BindValue(v8::Isolate* isolate, sqlite3_stmt* stmt, int index, v8::Local<v8::Value> value,
+                          TextEncoding encoding);
+
+    TextEncoding Encoding() const { return encoding_; }
+
+    struct NamedParameter {
+        int index;
+        v8::Global<v8::String> key;
+    };
+
+    // Named parameters with their prefix stripped, built on first use
+    const std::vector<NamedParameter>& NamedParameters(v8::Isolate* isolate, sqlite3_stmt* stmt);
+
+private:
+    TextEncoding encoding_;
+    std::vector<NamedParameter> named_parameters_;
+    bool named_parameters_initialized_ = false;
+
+    bool BindNamed(v8::Isolate* isolate, sqlite3_stmt* stmt, v8::Local<v8::Object> object);
+    void InitializeNamedParameters(v8::Isolate* isolate, sqlite3_stmt* stmt);
+};
+
+// Parameter values laid out as columns, bound one row at a time.
+//
+// Columns follow the shapes of ParameterBinder: an array of columns binds
+// positionally, an object of columns binds by name. Typed array columns
+// are read straight from their backing stores without creating any
+// handles; other arrays are read element by element. Only valid for the
+// duration of the native call that created it.
+class ParameterColumns {
+public:
+    // Returns false with a pending exception if `columns` can't be bound
+    bool Init(v8::Isolate* isolate, sqlite3_stmt* stmt, ParameterBinder& binder, v8::Local<v8::Value> columns);
+
+    // Number of rows that every column can provide
+    uint32_t RowCount() const { return row_count_; }
+
+    // Binds the values of `row`. Parameters without a column stay NULL.
+    bool BindRow(v8::Isolate* isolate, sqlite3_stmt* stmt, uint32_t row);
+
+private:
+    enum class Kind {
+        Float64,
+        Float32,
+        BigInt64,
+        BigUint64,
+        Int32,
+        Uint32,
+        Int16,
+        Uint16,
+        Int8,
+        Uint8,
+        Values
+    };
+
+    struct Column {
+        int index;
+        Kind kind;
+        const void* data;
+        v8::Local<v8::Array> values;
+        v8::Local<v8::TypedArray> typed;
+    };
+
+    std::vector<Column> columns_;
+    uint32_t row_count_ = UINT32_MAX;
+    TextEncoding encoding_ = TextEncoding::Utf16;
+    bool has_values_ = false;
+
+    bool AddColumn(v8::Isolate* isolate, int index, v8::Local<v8::Value> column);
+    // Reading a plain array can run JS (an accessor, or a Proxy on the
+    // prototype chain) that detaches or shrinks a typed array column, so
+    // their memory is only captured once all reads are done
+    void CaptureTypedColumns();
+    bool RecaptureTypedColumns(v8::Isolate* isolate, uint32_t row);
+};
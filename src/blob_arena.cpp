@@ -0,0 +1,92 @@
+#include "blob_arena.h"
+#include <node_buffer.h>
+#include <cstring>
+
+using v8::ArrayBuffer;
+using v8::Float32Array;
+using v8::Float64Array;
+using v8::Isolate;
+using v8::Local;
+using v8::Uint8Array;
+using v8::Value;
+
+// Small BLOBs like hashes and UUIDs share an ArrayBuffer; a BLOB that
+// would take up more than a quarter of one gets its own.
+static constexpr size_t kBlobSlabCapacity = 64 * 1024;
+static constexpr size_t kDedicatedThreshold = kBlobSlabCapacity / 4;
+
+bool ParseBlobMode(const char* name, BlobMode* mode) {
+    static const struct {
+        const char* name;
+        BlobMode mode;
+    } kModes[] = {
+        {"buffer", BlobMode::Buffer},
+        {"slab", BlobMode::Slab},
+        {"uint8array", BlobMode::Uint8Array},
+        {"float32array", BlobMode::Float32Array},
+        {"float64array", BlobMode::Float64Array},
+    };
+    for (const auto& entry : kModes) {
+        if (strcmp(name, entry.name) == 0) {
+            *mode = entry.mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+BlobArena::~BlobArena() {
+    current_.Reset();
+}
+
+size_t BlobArena::Allocate(Isolate* isolate, size_t length, size_t alignment, Local<ArrayBuffer>* buffer) {
+    if (length > kDedicatedThreshold) {
+        *buffer = ArrayBuffer::New(isolate, length);
+        return 0;
+    }
+
+    size_t offset = (used_ + alignment - 1) & ~(alignment - 1);
+    if (current_.IsEmpty() || offset > capacity_ || capacity_ - offset < length) {
+        Local<ArrayBuffer> slab = ArrayBuffer::New(isolate, kBlobSlabCapacity);
+        current_.Reset(isolate, slab);
+        capacity_ = kBlobSlabCapacity;
+        offset = 0;
+    }
+    used_ = offset + length;
+    *buffer = current_.Get(isolate);
+    return offset;
+}
+
+Local<Value> BlobArena::ToJS(Isolate* isolate, const void* data, size_t length) {
+    if (mode_ == BlobMode::Buffer) {
+        if (length == 0) {
+            return node::Buffer::New(isolate, 0).ToLocalChecked();
+        }
+        return node::Buffer::Copy(isolate, static_cast<const char*>(data), length).ToLocalChecked();
+    }
+
+    size_t element = 1;
+    if (mode_ == BlobMode::Float32Array && length % sizeof(float) == 0) {
+        element = sizeof(float);
+    } else if (mode_ == BlobMode::Float64Array && length % sizeof(double) == 0) {
+        element = sizeof(double);
+    }
+
+    Local<ArrayBuffer> buffer;
+    size_t offset = Allocate(isolate, length, element, &buffer);
+    if (length > 0) {
+        char* dest = static_cast<char*>(buffer->Data()) + offset;
+        memcpy(dest, data, length);
+    }
+
+    if (mode_ == BlobMode::Slab) {
+        return node::Buffer::New(isolate, buffer, offset, length).ToLocalChecked();
+    }
+    if (element == sizeof(float)) {
+        return Float32Array::New(buffer, offset, length / sizeof(float));
+    }
+    if (element == sizeof(double)) {
+        return Float64Array::New(buffer, offset, length / sizeof(double));
+    }
+    return Uint8Array::New(buffer, offset, length);
+}
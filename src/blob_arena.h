@@ -0,0 +1,53 @@
+#pragma once
+
+#include <v8.h>
+#include <cstddef>
+
+// How a statement returns BLOB values
+enum class BlobMode {
+    // A Buffer with its own memory per value
+    Buffer,
+    // Buffer views into an ArrayBuffer shared by the values of a batch
+    Slab,
+    // Typed array views into the shared ArrayBuffer, for BLOBs that hold
+    // packed numbers
+    Uint8Array,
+    Float32Array,
+    Float64Array
+};
+
+// Parses the name of a mode as passed to stmt.blobMode()
+bool ParseBlobMode(const char* name, BlobMode* mode);
+
+// Hands out ArrayBuffer space for the BLOBs of a batch of rows, so that a
+// batch costs one allocation instead of one per value. Views keep their
+// ArrayBuffer alive; the arena only refers to the one it is filling.
+class BlobArena {
+public:
+    BlobArena() = default;
+    ~BlobArena();
+
+    BlobArena(const BlobArena&) = delete;
+    BlobArena& operator=(const BlobArena&) = delete;
+
+    BlobMode Mode() const { return mode_; }
+    void SetMode(BlobMode mode) { mode_ = mode; }
+
+    // Copies `length` bytes into a value of the current mode. A BLOB that
+    // isn't a whole number of floats becomes a Uint8Array.
+    v8::Local<v8::Value> ToJS(v8::Isolate* isolate, const void* data, size_t length);
+
+    // Starts the next value in a new ArrayBuffer, so that values of
+    // different batches don't keep each other's memory alive. Touches no
+    // V8 handles.
+    void Reset() { used_ = capacity_; }
+
+private:
+    BlobMode mode_ = BlobMode::Buffer;
+    v8::Global<v8::ArrayBuffer> current_;
+    size_t capacity_ = 0;
+    size_t used_ = 0;
+
+    // Reserves `length` bytes at a multiple of `alignment`
+    size_t Allocate(v8::Isolate* isolate, size_t length, size_t alignment, v8::Local<v8::ArrayBuffer>* buffer);
+};
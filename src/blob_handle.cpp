@@ -0,0 +1,272 @@
+#include "blob_handle.h"
+#include "addon_data.h"
+#include "database.h"
+#include <climits>
+
+using v8::ArrayBufferView;
+using v8::BigInt;
+using v8::Context;
+using v8::Exception;
+using v8::FunctionCallbackInfo;
+using v8::FunctionTemplate;
+using v8::Function;
+using v8::Integer;
+using v8::Isolate;
+using v8::Local;
+using v8::NewStringType;
+using v8::Number;
+using v8::Object;
+using v8::String;
+using v8::Value;
+
+static void ThrowError(Isolate* isolate, const char* message) {
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, message, NewStringType::kNormal).ToLocalChecked()));
+}
+
+static void ThrowRangeError(Isolate* isolate, const char* message) {
+    isolate->ThrowException(Exception::RangeError(
+        String::NewFromUtf8(isolate, message, NewStringType::kNormal).ToLocalChecked()));
+}
+
+bool RowidFromJS(Isolate* isolate, Local<Value> value, sqlite3_int64* rowid) {
+    if (value->IsBigInt()) {
+        bool lossless;
+        *rowid = value.As<BigInt>()->Int64Value(&lossless);
+        if (lossless) {
+            return true;
+        }
+    } else if (value->IsNumber()) {
+        double number = value.As<Number>()->Value();
+        if (number >= -9007199254740992.0 && number <= 9007199254740992.0 &&
+            number == static_cast<double>(static_cast<sqlite3_int64>(number))) {
+            *rowid = static_cast<sqlite3_int64>(number);
+            return true;
+        }
+    }
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "rowid must be an integer or a bigint", NewStringType::kNormal).ToLocalChecked()));
+    return false;
+}
+
+BlobHandle::BlobHandle(sqlite3_blob* blob, Database* db) : blob_(blob), db_(db) {
+}
+
+void BlobHandle::Init(Local<Object> exports, AddonData* addon_data) {
+    Isolate* isolate = exports->GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, New);
+    tpl->SetClassName(String::NewFromUtf8(isolate, "BlobHandle", NewStringType::kNormal).ToLocalChecked());
+    // The second field holds the database object to keep it alive
+    tpl->InstanceTemplate()->SetInternalFieldCount(2);
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "size", Size);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "read", Read);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "write", Write);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "reopen", Reopen);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+
+    Local<Function> constructor_local = tpl->GetFunction(context).ToLocalChecked();
+    addon_data->blob_handle_constructor.Reset(isolate, constructor_local);
+    exports->Set(context, String::NewFromUtf8(isolate, "BlobHandle", NewStringType::kNormal).ToLocalChecked(),
+                 constructor_local)
+        .FromJust();
+}
+
+Local<Object> BlobHandle::NewInstance(Isolate* isolate, sqlite3_blob* blob, Database* db, Local<Object> database) {
+    Local<Context> context = isolate->GetCurrentContext();
+    Local<Function> cons = db->GetAddonData()->blob_handle_constructor.Get(isolate);
+    Local<Object> instance = cons->NewInstance(context, 0, nullptr).ToLocalChecked();
+
+    BlobHandle* handle = new BlobHandle(blob, db);
+    handle->Wrap(instance);
+    instance->SetInternalField(1, database);
+    db->RegisterBlob(handle);
+
+    return instance;
+}
+
+void BlobHandle::New(const FunctionCallbackInfo<Value>& args) {
+    if (args.IsConstructCall()) {
+        args.GetReturnValue().Set(args.This());
+    } else {
+        ThrowError(args.GetIsolate(), "BlobHandle constructor called without new");
+    }
+}
+
+void BlobHandle::Size(const FunctionCallbackInfo<Value>& args) {
+    BlobHandle* handle = UnwrapUsable(args);
+    if (!handle) {
+        return;
+    }
+    args.GetReturnValue().Set(sqlite3_blob_bytes(handle->blob_));
+}
+
+// Checks the (view, offset) arguments of read() and write() against the
+// size of the BLOB and returns how many bytes the call covers
+static bool TransferArguments(const FunctionCallbackInfo<Value>& args, sqlite3_blob* blob, Local<ArrayBufferView>* view,
+                              int* offset, int* length) {
+    Isolate* isolate = args.GetIsolate();
+
+    if (args.Length() < 1 || !args[0]->IsArrayBufferView()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Buffer or typed array required", NewStringType::kNormal).ToLocalChecked()));
+        return false;
+    }
+    *view = args[0].As<ArrayBufferView>();
+
+    int size = sqlite3_blob_bytes(blob);
+    double start = args.Length() > 1 && !args[1]->IsUndefined()
+        ? (args[1]->IsNumber() ? args[1].As<Number>()->Value() : -1)
+        : 0;
+    if (!(start >= 0 && start <= size) || start != static_cast<double>(static_cast<int>(start))) {
+        ThrowRangeError(isolate, "offset must be an integer within the BLOB");
+        return false;
+    }
+    *offset = static_cast<int>(start);
+
+    size_t bytes = (*view)->ByteLength();
+    *length = bytes > static_cast<size_t>(INT_MAX) ? INT_MAX : static_cast<int>(bytes);
+    return true;
+}
+
+// Reads into the view from `offset`, up to the end of the BLOB, and
+// returns the number of bytes read
+void BlobHandle::Read(const FunctionCallbackInfo<Value>& args) {
+    BlobHandle* handle = UnwrapUsable(args);
+    if (!handle) {
+        return;
+    }
+
+    Local<ArrayBufferView> view;
+    int offset;
+    int length;
+    if (!TransferArguments(args, handle->blob_, &view, &offset, &length)) {
+        return;
+    }
+
+    int available = sqlite3_blob_bytes(handle->blob_) - offset;
+    if (length > available) {
+        length = available;
+    }
+    if (length > 0) {
+        char* data = static_cast<char*>(view->Buffer()->Data()) + view->ByteOffset();
+        int rc = sqlite3_blob_read(handle->blob_, data, length, offset);
+        if (rc != SQLITE_OK) {
+            ThrowError(args.GetIsolate(), sqlite3_errmsg(handle->db_->GetDb()));
+            return;
+        }
+    }
+    args.GetReturnValue().Set(length);
+}
+
+// Writes all of the view at `offset`. A BLOB never grows: it has to be
+// inserted at its final size, e.g. with zeroblob(), before it is written.
+void BlobHandle::Write(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+
+    BlobHandle* handle = UnwrapUsable(args);
+    if (!handle) {
+        return;
+    }
+
+    Local<ArrayBufferView> view;
+    int offset;
+    int length;
+    if (!TransferArguments(args, handle->blob_, &view, &offset, &length)) {
+        return;
+    }
+
+    if (view->ByteLength() > static_cast<size_t>(sqlite3_blob_bytes(handle->blob_) - offset)) {
+        ThrowRangeError(isolate, "Write past the end of the BLOB");
+        return;
+    }
+    if (length > 0) {
+        const char* data = static_cast<const char*>(view->Buffer()->Data()) + view->ByteOffset();
+        int rc = sqlite3_blob_write(handle->blob_, data, length, offset);
+        if (rc != SQLITE_OK) {
+            ThrowError(isolate, sqlite3_errmsg(handle->db_->GetDb()));
+        }
+    }
+}
+
+// Moves the handle to the same column of another row, which is cheaper
+// than opening a new one
+void BlobHandle::Reopen(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+
+    BlobHandle* handle = UnwrapUsable(args);
+    if (!handle) {
+        return;
+    }
+
+    sqlite3_int64 rowid;
+    if (!RowidFromJS(isolate, args[0], &rowid)) {
+        return;
+    }
+
+    int rc = sqlite3_blob_reopen(handle->blob_, rowid);
+    if (rc != SQLITE_OK) {
+        // The handle can't be used after a failed reopen
+        ThrowError(isolate, sqlite3_errmsg(handle->db_->GetDb()));
+        handle->Invalidate();
+    }
+}
+
+void BlobHandle::Close(const FunctionCallbackInfo<Value>& args) {
+    BlobHandle* handle = Unwrap(args.Holder());
+    if (handle && handle->blob_ && handle->db_->IsBusy()) {
+        ThrowError(args.GetIsolate(), "Database is busy with an asynchronous operation");
+        return;
+    }
+    if (handle) {
+        handle->Invalidate();
+    }
+}
+
+void BlobHandle::Invalidate() {
+    if (blob_) {
+        sqlite3_blob_close(blob_);
+        blob_ = nullptr;
+    }
+}
+
+void BlobHandle::WeakCallback(const v8::WeakCallbackInfo<BlobHandle>& info) {
+    info.GetParameter()->handle_.Reset();
+    info.SetSecondPassCallback(Collect);
+}
+
+void BlobHandle::Collect(const v8::WeakCallbackInfo<BlobHandle>& info) {
+    BlobHandle* handle = info.GetParameter();
+    if (handle->blob_) {
+        handle->db_->ReleaseBlob(handle->blob_);
+    }
+    handle->db_->UnregisterBlob(handle);
+    delete handle;
+}
+
+BlobHandle* BlobHandle::Unwrap(Local<Object> obj) {
+    return static_cast<BlobHandle*>(obj->GetAlignedPointerFromInternalField(0));
+}
+
+BlobHandle* BlobHandle::UnwrapUsable(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+
+    BlobHandle* handle = Unwrap(args.Holder());
+    if (!handle || !handle->blob_) {
+        ThrowError(isolate, "BLOB is closed");
+        return nullptr;
+    }
+    if (handle->db_->IsBusy()) {
+        ThrowError(isolate, "Database is busy with an asynchronous operation");
+        return nullptr;
+    }
+    return handle;
+}
+
+void BlobHandle::Wrap(Local<Object> obj) {
+    obj->SetAlignedPointerInInternalField(0, this);
+    handle_.Reset(obj->GetIsolate(), obj);
+    handle_.SetWeak(this, WeakCallback, v8::WeakCallbackType::kParameter);
+}
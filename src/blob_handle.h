@@ -0,0 +1,48 @@
+#pragma once
+
+#include <v8.h>
+#include <node.h>
+#include <sqlite3.h>
+
+class Database;
+struct AddonData;
+
+// An open BLOB, read and written in place with sqlite3_blob_read() and
+// sqlite3_blob_write(), so that large values never have to be held in
+// memory at once. Returned by db.openBlob(); the streams of index.js are
+// built on it.
+class BlobHandle {
+public:
+    static void Init(v8::Local<v8::Object> exports, AddonData* addon_data);
+    static v8::Local<v8::Object> NewInstance(v8::Isolate* isolate, sqlite3_blob* blob, Database* db,
+                                             v8::Local<v8::Object> database);
+
+    static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Size(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Read(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Write(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Reopen(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value>& args);
+
+    // Closes the handle when the database closes underneath it
+    void Invalidate();
+
+private:
+    BlobHandle(sqlite3_blob* blob, Database* db);
+
+    sqlite3_blob* blob_;
+    Database* db_;
+    v8::Global<v8::Object> handle_;
+
+    static void WeakCallback(const v8::WeakCallbackInfo<BlobHandle>& info);
+    static void Collect(const v8::WeakCallbackInfo<BlobHandle>& info);
+
+    static BlobHandle* Unwrap(v8::Local<v8::Object> obj);
+    // Unwraps the receiver, throwing if it is closed or its database is busy
+    static BlobHandle* UnwrapUsable(const v8::FunctionCallbackInfo<v8::Value>& args);
+    void Wrap(v8::Local<v8::Object> obj);
+};
+
+// Reads a rowid given as a number or a bigint. Returns false with a
+// pending exception otherwise.
+bool RowidFromJS(v8::Isolate* isolate, v8::Local<v8::Value> value, sqlite3_int64* rowid);
@@ -0,0 +1,296 @@
+#include "columnar.h"
+#include <node_buffer.h>
+#include <cctype>
+#include <climits>
+#include <memory>
+#include <string>
+
+using v8::Array;
+using v8::ArrayBuffer;
+using v8::BackingStore;
+using v8::BigInt64Array;
+using v8::Context;
+using v8::Float64Array;
+using v8::Int32Array;
+using v8::Isolate;
+using v8::Local;
+using v8::NewStringType;
+using v8::Object;
+using v8::String;
+using v8::Uint8Array;
+using v8::Value;
+
+const char* ColumnKindName(ColumnKind kind) {
+    switch (kind) {
+    case ColumnKind::Integer: return "integer";
+    case ColumnKind::Real: return "real";
+    case ColumnKind::Text: return "text";
+    default: return "blob";
+    }
+}
+
+const char* StorageClassName(int type) {
+    switch (type) {
+    case SQLITE_INTEGER: return "integer";
+    case SQLITE_FLOAT: return "real";
+    case SQLITE_TEXT: return "text";
+    case SQLITE_BLOB: return "blob";
+    default: return "null";
+    }
+}
+
+static ColumnKind KindFromStorageClass(int type) {
+    switch (type) {
+    case SQLITE_INTEGER: return ColumnKind::Integer;
+    case SQLITE_TEXT: return ColumnKind::Text;
+    case SQLITE_BLOB: return ColumnKind::Blob;
+    default: return ColumnKind::Real;
+    }
+}
+
+// Whether a non-NULL value of storage class `type` can be stored in a
+// column of `kind` as it is; integers widen to reals
+static bool KindHolds(ColumnKind kind, int type) {
+    switch (kind) {
+    case ColumnKind::Integer: return type == SQLITE_INTEGER;
+    case ColumnKind::Real: return type == SQLITE_FLOAT || type == SQLITE_INTEGER;
+    case ColumnKind::Text: return type == SQLITE_TEXT;
+    default: return type == SQLITE_BLOB;
+    }
+}
+
+// Follows SQLite's column affinity rules, except that a declared BLOB maps
+// to blob; returns false for columns without a declared type.
+static bool KindFromDeclaredType(const char* decltype_, ColumnKind* kind) {
+    if (!decltype_ || !*decltype_) {
+        return false;
+    }
+
+    std::string type(decltype_);
+    for (auto& c : type) {
+        c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    }
+
+    if (type.find("INT") != std::string::npos) {
+        *kind = ColumnKind::Integer;
+    } else if (type.find("CHAR") != std::string::npos || type.find("CLOB") != std::string::npos ||
+               type.find("TEXT") != std::string::npos) {
+        *kind = ColumnKind::Text;
+    } else if (type.find("BLOB") != std::string::npos) {
+        *kind = ColumnKind::Blob;
+    } else {
+        *kind = ColumnKind::Real;
+    }
+    return true;
+}
+
+ColumnarBatch::ColumnarBatch(sqlite3_stmt* stmt, std::vector<ColumnKind>& kinds, bool bigint)
+    : stmt_(stmt), kinds_(kinds), bigint_(bigint), rows_(0), mismatch_column_(-1), mismatch_type_(SQLITE_NULL) {
+}
+
+void ColumnarBatch::InitializeKinds(std::vector<ColumnKind>& kinds) {
+    int colCount = sqlite3_column_count(stmt_);
+    bool hasRow = sqlite3_data_count(stmt_) > 0;
+    kinds.resize(colCount);
+    unsettled_.assign(colCount, false);
+
+    for (int i = 0; i < colCount; i++) {
+        if (KindFromDeclaredType(sqlite3_column_decltype(stmt_, i), &kinds[i])) {
+            continue;
+        }
+        int type = hasRow ? sqlite3_column_type(stmt_, i) : SQLITE_NULL;
+        kinds[i] = KindFromStorageClass(type);
+        unsettled_[i] = type == SQLITE_NULL;
+    }
+}
+
+// Gives an untyped column the kind of its first non-NULL value. The rows
+// before it are all NULL, so their placeholders are simply redone.
+void ColumnarBatch::SettleColumn(size_t index, int type) {
+    ColumnKind kind = KindFromStorageClass(type);
+    Column& column = columns_[index];
+    kinds_[index] = kind;
+    column.kind = kind;
+    column.doubles.clear();
+    column.ints.clear();
+    column.offsets.clear();
+    switch (kind) {
+    case ColumnKind::Integer:
+        if (bigint_) {
+            column.ints.assign(rows_, 0);
+        } else {
+            column.doubles.assign(rows_, 0);
+        }
+        break;
+    case ColumnKind::Real:
+        column.doubles.assign(rows_, 0);
+        break;
+    default:
+        column.offsets.assign(rows_ + 1, 0);
+        break;
+    }
+    unsettled_[index] = false;
+}
+
+void ColumnarBatch::InitializeColumns(const std::vector<ColumnKind>& kinds) {
+    columns_.resize(kinds.size());
+    for (size_t i = 0; i < kinds.size(); i++) {
+        columns_[i].kind = kinds[i];
+        if (kinds[i] == ColumnKind::Text || kinds[i] == ColumnKind::Blob) {
+            columns_[i].offsets.push_back(0);
+        }
+    }
+}
+
+ColumnarBatch::AppendResult ColumnarBatch::AppendRow() {
+    if (columns_.empty()) {
+        if (kinds_.empty()) {
+            InitializeKinds(kinds_);
+        }
+        InitializeColumns(kinds_);
+    }
+
+    if (rows_ % 8 == 0) {
+        for (auto& column : columns_) {
+            column.nulls.push_back(0);
+        }
+    }
+
+    for (size_t i = 0; i < columns_.size(); i++) {
+        Column& column = columns_[i];
+        int index = static_cast<int>(i);
+        int type = sqlite3_column_type(stmt_, index);
+        bool isNull = type == SQLITE_NULL;
+        if (isNull) {
+            column.nulls.back() |= static_cast<uint8_t>(1 << (rows_ % 8));
+        } else {
+            if (i < unsettled_.size() && unsettled_[i]) {
+                SettleColumn(i, type);
+            }
+            if (!KindHolds(column.kind, type)) {
+                mismatch_column_ = index;
+                mismatch_type_ = type;
+                return AppendResult::TypeMismatch;
+            }
+        }
+
+        switch (column.kind) {
+        case ColumnKind::Integer:
+            if (bigint_) {
+                column.ints.push_back(sqlite3_column_int64(stmt_, index));
+            } else {
+                column.doubles.push_back(static_cast<double>(sqlite3_column_int64(stmt_, index)));
+            }
+            break;
+        case ColumnKind::Real:
+            column.doubles.push_back(sqlite3_column_double(stmt_, index));
+            break;
+        case ColumnKind::Text:
+        case ColumnKind::Blob: {
+            const void* bytes = nullptr;
+            int length = 0;
+            if (!isNull) {
+                bytes = column.kind == ColumnKind::Text ? static_cast<const void*>(sqlite3_column_text(stmt_, index))
+                                                        : sqlite3_column_blob(stmt_, index);
+                length = sqlite3_column_bytes(stmt_, index);
+            }
+            if (column.data.size() + length > static_cast<size_t>(INT32_MAX)) {
+                return AppendResult::TooLarge;
+            }
+            if (length > 0) {
+                const uint8_t* begin = static_cast<const uint8_t*>(bytes);
+                column.data.insert(column.data.end(), begin, begin + length);
+            }
+            column.offsets.push_back(static_cast<int32_t>(column.data.size()));
+            break;
+        }
+        }
+    }
+
+    rows_++;
+    return AppendResult::Ok;
+}
+
+std::vector<ColumnarBatch::Column>& ColumnarBatch::Columns() {
+    // An empty batch still describes its columns, but only a real row may
+    // settle the kinds of untyped columns for the batches that follow
+    if (columns_.empty()) {
+        if (kinds_.empty()) {
+            std::vector<ColumnKind> kinds;
+            InitializeKinds(kinds);
+            InitializeColumns(kinds);
+        } else {
+            InitializeColumns(kinds_);
+        }
+    }
+    return columns_;
+}
+
+// Hands a vector's storage to an ArrayBuffer without copying it
+template <typename T>
+static Local<ArrayBuffer> ToArrayBuffer(Isolate* isolate, std::vector<T>& values) {
+    if (values.empty()) {
+        return ArrayBuffer::New(isolate, 0);
+    }
+
+    auto* owned = new std::vector<T>(std::move(values));
+    std::unique_ptr<BackingStore> store = ArrayBuffer::NewBackingStore(
+        owned->data(), owned->size() * sizeof(T),
+        [](void*, size_t, void* deleter_data) {
+            delete static_cast<std::vector<T>*>(deleter_data);
+        },
+        owned);
+    return ArrayBuffer::New(isolate, std::move(store));
+}
+
+Local<Array> ColumnarBatch::ToJS(Isolate* isolate, const std::vector<v8::Global<String>>& names) {
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Local<String> nameKey = String::NewFromUtf8(isolate, "name", NewStringType::kInternalized).ToLocalChecked();
+    Local<String> typeKey = String::NewFromUtf8(isolate, "type", NewStringType::kInternalized).ToLocalChecked();
+    Local<String> valuesKey = String::NewFromUtf8(isolate, "values", NewStringType::kInternalized).ToLocalChecked();
+    Local<String> offsetsKey = String::NewFromUtf8(isolate, "offsets", NewStringType::kInternalized).ToLocalChecked();
+    Local<String> dataKey = String::NewFromUtf8(isolate, "data", NewStringType::kInternalized).ToLocalChecked();
+    Local<String> nullsKey = String::NewFromUtf8(isolate, "nulls", NewStringType::kInternalized).ToLocalChecked();
+
+    Columns();
+
+    std::vector<Local<Value>> result;
+    result.reserve(columns_.size());
+
+    for (size_t i = 0; i < columns_.size(); i++) {
+        Column& column = columns_[i];
+        Local<Object> entry = Object::New(isolate);
+
+        entry->Set(context, nameKey, names[i].Get(isolate)).Check();
+        entry->Set(context, typeKey,
+                   String::NewFromUtf8(isolate, ColumnKindName(column.kind), NewStringType::kInternalized).ToLocalChecked())
+            .Check();
+
+        switch (column.kind) {
+        case ColumnKind::Integer:
+            if (bigint_) {
+                entry->Set(context, valuesKey, BigInt64Array::New(ToArrayBuffer(isolate, column.ints), 0, rows_)).Check();
+                break;
+            }
+            [[fallthrough]];
+        case ColumnKind::Real:
+            entry->Set(context, valuesKey, Float64Array::New(ToArrayBuffer(isolate, column.doubles), 0, rows_)).Check();
+            break;
+        case ColumnKind::Text:
+        case ColumnKind::Blob: {
+            size_t bytes = column.data.size();
+            entry->Set(context, offsetsKey, Int32Array::New(ToArrayBuffer(isolate, column.offsets), 0, rows_ + 1)).Check();
+            entry->Set(context, dataKey, node::Buffer::New(isolate, ToArrayBuffer(isolate, column.data), 0, bytes).ToLocalChecked()).Check();
+            break;
+        }
+        }
+
+        size_t nullBytes = column.nulls.size();
+        entry->Set(context, nullsKey, Uint8Array::New(ToArrayBuffer(isolate, column.nulls), 0, nullBytes)).Check();
+
+        result.push_back(entry);
+    }
+
+    return Array::New(isolate, result.data(), result.size());
+}
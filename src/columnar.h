@@ -0,0 +1,85 @@
+#pragma once
+
+#include <v8.h>
+#include <sqlite3.h>
+#include <cstdint>
+#include <vector>
+
+enum class ColumnKind {
+    Integer,
+    Real,
+    Text,
+    Blob
+};
+
+// Accumulates rows of a statement column by column, without creating any
+// V8 values until the batch is handed over as typed arrays.
+//
+// The kind of each column is decided once, from its declared type or else
+// from the first non-NULL value of the first batch, and stored in `kinds`
+// so that every batch of a statement has the same layout. An untyped
+// column that is NULL throughout the first batch is real. A real column
+// also takes integers; any other value of another storage class is
+// rejected rather than converted, since the conversion would lose it.
+class ColumnarBatch {
+public:
+    ColumnarBatch(sqlite3_stmt* stmt, std::vector<ColumnKind>& kinds, bool bigint);
+
+    enum class AppendResult {
+        Ok,
+        // A text or blob column would grow past what 32-bit offsets can address
+        TooLarge,
+        // A value doesn't fit the kind of its column; see MismatchColumn()
+        TypeMismatch
+    };
+
+    // Appends the statement's current row, or as much of it as fits
+    // before failing
+    AppendResult AppendRow();
+
+    // After a TypeMismatch, the column and the storage class of its value
+    int MismatchColumn() const { return mismatch_column_; }
+    int MismatchType() const { return mismatch_type_; }
+
+    size_t RowCount() const { return rows_; }
+
+    // Integers are in `ints` when the batch was created with `bigint`,
+    // otherwise in `doubles`. Bit i of `nulls` is set when row i is NULL.
+    struct Column {
+        ColumnKind kind;
+        std::vector<double> doubles;
+        std::vector<int64_t> ints;
+        std::vector<uint8_t> nulls;
+        std::vector<int32_t> offsets;
+        std::vector<uint8_t> data;
+    };
+
+    // The accumulated columns, which an empty batch still describes
+    std::vector<Column>& Columns();
+
+    // Moves the accumulated data into typed arrays:
+    // [{ name, type, values | offsets + data, nulls }, ...]
+    v8::Local<v8::Array> ToJS(v8::Isolate* isolate, const std::vector<v8::Global<v8::String>>& names);
+
+private:
+
+    sqlite3_stmt* stmt_;
+    std::vector<ColumnKind>& kinds_;
+    bool bigint_;
+    size_t rows_;
+    std::vector<Column> columns_;
+    // Untyped columns that have only been NULL so far in the batch that
+    // decides the kinds
+    std::vector<bool> unsettled_;
+    int mismatch_column_;
+    int mismatch_type_;
+
+    void InitializeKinds(std::vector<ColumnKind>& kinds);
+    void InitializeColumns(const std::vector<ColumnKind>& kinds);
+    void SettleColumn(size_t index, int type);
+};
+
+const char* ColumnKindName(ColumnKind kind);
+
+// Name of a SQLite storage class (SQLITE_INTEGER, ...), for messages
+const char* StorageClassName(int type);
@@ -0,0 +1,519 @@
+#include "csv_import.h"
+#include "simd_text.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// The file is read this much at a time, and handed to parsers in chunks of
+// at least kChunkBytes of whole records
+static constexpr size_t kReadBytes = 1 << 20;
+static constexpr size_t kChunkBytes = 4 << 20;
+static constexpr unsigned kMaxParsers = 8;
+
+struct CsvField {
+    enum Type : uint8_t {
+        Null,
+        Integer,
+        Real,
+        Text
+    };
+
+    union {
+        int64_t integer;
+        double real;
+    };
+    uint32_t offset;
+    uint32_t length;
+    Type type;
+};
+
+struct CsvChunk {
+    size_t sequence;
+    // Whole records; quoted fields are unescaped in place
+    std::string bytes;
+    std::vector<CsvField> fields;
+    // Index in `fields` one past the last field of each record
+    std::vector<size_t> record_ends;
+};
+
+// Numbers are only converted when printing them back gives the same text,
+// so that binding them can't change what a TEXT column stores ("007",
+// "1.50"). An empty unquoted field is NULL.
+static void ConvertField(const char* text, CsvField* field) {
+    size_t length = field->length;
+    const char* end = text + length;
+    if (length == 0) {
+        field->type = CsvField::Null;
+        return;
+    }
+
+    int64_t integer;
+    auto parsed = std::from_chars(text, end, integer);
+    if (parsed.ec == std::errc() && parsed.ptr == end) {
+        bool leading_zero = (text[0] == '0' && length > 1) || (text[0] == '-' && text[1] == '0');
+        if (!leading_zero) {
+            field->type = CsvField::Integer;
+            field->integer = integer;
+            return;
+        }
+    } else {
+        double real;
+        parsed = std::from_chars(text, end, real);
+        if (parsed.ec == std::errc() && parsed.ptr == end && std::isfinite(real)) {
+            char digits[32];
+            auto printed = std::to_chars(digits, digits + sizeof(digits), real);
+            if (static_cast<size_t>(printed.ptr - digits) == length && memcmp(digits, text, length) == 0) {
+                field->type = CsvField::Real;
+                field->real = real;
+                return;
+            }
+        }
+    }
+    field->type = CsvField::Text;
+}
+
+// End of an unquoted field; quotes inside one are kept as they are
+static size_t FieldEnd(const char* s, size_t i, size_t n, char delimiter) {
+    for (;;) {
+        i += FindCsvSpecial(s + i, n - i, delimiter);
+        if (i == n || s[i] != '"') {
+            return i;
+        }
+        i++;
+    }
+}
+
+// Splits a chunk into fields following RFC 4180. Records end at LF, CRLF
+// or CR; blank lines hold no record.
+static void ParseChunk(CsvChunk& chunk, char delimiter) {
+    char* s = chunk.bytes.data();
+    size_t n = chunk.bytes.size();
+    size_t i = 0;
+    while (i < n) {
+        if (s[i] == '\n' || s[i] == '\r') {
+            i++;
+            continue;
+        }
+
+        for (;;) {
+            CsvField field;
+            field.offset = static_cast<uint32_t>(i);
+            if (i < n && s[i] == '"') {
+                // Unescaping only ever shortens the field
+                size_t out = i;
+                i++;
+                for (;;) {
+                    const char* quote = static_cast<const char*>(memchr(s + i, '"', n - i));
+                    size_t j = quote ? static_cast<size_t>(quote - s) : n;
+                    memmove(s + out, s + i, j - i);
+                    out += j - i;
+                    i = std::min(j + 1, n);
+                    if (quote && i < n && s[i] == '"') {
+                        s[out++] = '"';
+                        i++;
+                        continue;
+                    }
+                    break;
+                }
+                field.length = static_cast<uint32_t>(out - field.offset);
+                field.type = CsvField::Text;
+                // Anything between the closing quote and the delimiter is dropped
+                i = FieldEnd(s, i, n, delimiter);
+            } else {
+                size_t end = FieldEnd(s, i, n, delimiter);
+                field.length = static_cast<uint32_t>(end - i);
+                ConvertField(s + i, &field);
+                i = end;
+            }
+            chunk.fields.push_back(field);
+
+            if (i < n && s[i] == delimiter) {
+                i++;
+                continue;
+            }
+            if (i < n && s[i] == '\r') {
+                i++;
+            }
+            if (i < n && s[i] == '\n') {
+                i++;
+            }
+            break;
+        }
+        chunk.record_ends.push_back(chunk.fields.size());
+    }
+}
+
+// Identifiers are quoted, so any table or column name can be used as is
+static void AppendIdentifier(std::string& sql, const char* name, size_t length) {
+    sql.push_back('"');
+    for (size_t i = 0; i < length; i++) {
+        if (name[i] == '"') {
+            sql.push_back('"');
+        }
+        sql.push_back(name[i]);
+    }
+    sql.push_back('"');
+}
+
+class CsvImport {
+public:
+    CsvImport(int fd, const CsvImportOptions& options) : fd_(fd), options_(options) {}
+
+    bool Run(sqlite3* db, const std::string& table, uint64_t* rows, std::string* error);
+
+private:
+    int fd_;
+    CsvImportOptions options_;
+
+    // Where the boundary scan stopped, in the terms of ParseChunk: at the
+    // start of a field, in an unquoted field or the tail after a closing
+    // quote, inside quotes, or just past a quote inside quotes, which
+    // either closes the field or starts an escaped quote
+    enum class ScanState : uint8_t {
+        FieldStart,
+        Unquoted,
+        Quoted,
+        QuoteInQuoted
+    };
+
+    // Reading state, used by one parser at a time. pending_ holds what was
+    // read but not handed out yet: scanned_ bytes of it were scanned for
+    // record boundaries, ending in scan_state_, and the last complete
+    // record ends at boundary_.
+    std::mutex read_mutex_;
+    std::string pending_;
+    size_t scanned_ = 0;
+    size_t boundary_ = 0;
+    ScanState scan_state_ = ScanState::FieldStart;
+    bool eof_ = false;
+    size_t next_sequence_ = 0;
+    std::string read_error_;
+
+    // Parsed chunks wait in ready_ until the writer gets to their turn. At
+    // most in_flight_limit_ chunks are read and not yet inserted at a time.
+    std::mutex mutex_;
+    std::condition_variable parsed_;
+    std::condition_variable inserted_;
+    std::map<size_t, std::unique_ptr<CsvChunk>> ready_;
+    size_t in_flight_ = 0;
+    size_t in_flight_limit_ = 0;
+    unsigned parsers_running_ = 0;
+    bool stop_ = false;
+
+    std::unique_ptr<CsvChunk> ReadChunk();
+    void ScanBoundaries();
+    void Parse();
+    std::unique_ptr<CsvChunk> NextParsed(size_t sequence);
+    void Stop(std::vector<std::thread>& parsers);
+    bool Insert(sqlite3_stmt* stmt, const CsvChunk& chunk, size_t skip, size_t columns, uint64_t* record, uint64_t* rows,
+                std::string* error);
+};
+
+// Finds record boundaries the way ParseChunk will split the records: a
+// quote only opens a field at its start, "" inside quotes is a quote, and
+// records end at CR or LF outside quotes. Chunks cut anywhere else would
+// be parsed differently from the file as a whole.
+void CsvImport::ScanBoundaries() {
+    const char* s = pending_.data();
+    size_t n = pending_.size();
+    char delimiter = options_.delimiter;
+    size_t i = scanned_;
+    while (i < n) {
+        if (scan_state_ == ScanState::Quoted) {
+            const char* quote = static_cast<const char*>(memchr(s + i, '"', n - i));
+            if (!quote) {
+                break;
+            }
+            i = static_cast<size_t>(quote - s) + 1;
+            scan_state_ = ScanState::QuoteInQuoted;
+            continue;
+        }
+        if (scan_state_ == ScanState::QuoteInQuoted) {
+            if (s[i] == '"') {
+                scan_state_ = ScanState::Quoted;
+                i++;
+                continue;
+            }
+            scan_state_ = ScanState::Unquoted;
+        }
+        if (scan_state_ == ScanState::FieldStart && s[i] == '"') {
+            scan_state_ = ScanState::Quoted;
+            i++;
+            continue;
+        }
+
+        // Quotes past the start of an unquoted field are kept as they are
+        i = FieldEnd(s, i, n, delimiter);
+        if (i == n) {
+            scan_state_ = ScanState::Unquoted;
+            break;
+        }
+        if (s[i] != delimiter) {
+            boundary_ = i + 1;
+        }
+        scan_state_ = ScanState::FieldStart;
+        i++;
+    }
+    scanned_ = n;
+}
+
+// Returns the next chunk of whole records, or null at the end of the file
+// or after a read error. Needs read_mutex_, except before parsers start.
+std::unique_ptr<CsvChunk> CsvImport::ReadChunk() {
+    while (!eof_ && read_error_.empty() && boundary_ < kChunkBytes) {
+        size_t used = pending_.size();
+        pending_.resize(used + kReadBytes);
+        ssize_t n;
+        do {
+            n = read(fd_, pending_.data() + used, kReadBytes);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            read_error_ = std::string("Cannot read CSV file: ") + strerror(errno);
+            pending_.resize(used);
+            break;
+        }
+        pending_.resize(used + static_cast<size_t>(n));
+        eof_ = n == 0;
+        ScanBoundaries();
+        if (pending_.size() > UINT32_MAX) {
+            read_error_ = "CSV record exceeds 4 GiB";
+        }
+    }
+    if (!read_error_.empty()) {
+        return nullptr;
+    }
+
+    size_t end = eof_ ? pending_.size() : boundary_;
+    if (end == 0) {
+        return nullptr;
+    }
+    auto chunk = std::make_unique<CsvChunk>();
+    chunk->sequence = next_sequence_++;
+    // Only the partial record after the boundary is copied
+    chunk->bytes = std::move(pending_);
+    pending_.reserve(kChunkBytes + kReadBytes);
+    pending_.assign(chunk->bytes, end, std::string::npos);
+    chunk->bytes.resize(end);
+    scanned_ -= end;
+    boundary_ = 0;
+    return chunk;
+}
+
+// Parser thread: reads and parses chunks until the file or the import ends
+void CsvImport::Parse() {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            inserted_.wait(lock, [this] { return stop_ || in_flight_ < in_flight_limit_; });
+            if (stop_) {
+                break;
+            }
+            in_flight_++;
+        }
+
+        std::unique_ptr<CsvChunk> chunk;
+        {
+            std::lock_guard<std::mutex> lock(read_mutex_);
+            chunk = ReadChunk();
+        }
+        if (!chunk) {
+            break;
+        }
+        ParseChunk(*chunk, options_.delimiter);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_[chunk->sequence] = std::move(chunk);
+        parsed_.notify_one();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    parsers_running_--;
+    parsed_.notify_one();
+}
+
+// Waits for the chunk with the given sequence number. Null once every
+// chunk has been handed out.
+std::unique_ptr<CsvChunk> CsvImport::NextParsed(size_t sequence) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    parsed_.wait(lock, [&] { return ready_.count(sequence) > 0 || parsers_running_ == 0; });
+    auto it = ready_.find(sequence);
+    if (it == ready_.end()) {
+        return nullptr;
+    }
+    std::unique_ptr<CsvChunk> chunk = std::move(it->second);
+    ready_.erase(it);
+    return chunk;
+}
+
+void CsvImport::Stop(std::vector<std::thread>& parsers) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    inserted_.notify_all();
+    for (std::thread& parser : parsers) {
+        parser.join();
+    }
+}
+
+bool CsvImport::Insert(sqlite3_stmt* stmt, const CsvChunk& chunk, size_t skip, size_t columns, uint64_t* record,
+                       uint64_t* rows, std::string* error) {
+    size_t begin = 0;
+    for (size_t r = 0; r < chunk.record_ends.size(); r++) {
+        size_t end = chunk.record_ends[r];
+        (*record)++;
+        if (r < skip) {
+            begin = end;
+            continue;
+        }
+        if (end - begin != columns) {
+            *error = "CSV record " + std::to_string(*record) + " has " + std::to_string(end - begin) +
+                     " fields, expected " + std::to_string(columns);
+            return false;
+        }
+
+        for (size_t c = 0; c < columns; c++) {
+            const CsvField& field = chunk.fields[begin + c];
+            int index = static_cast<int>(c + 1);
+            switch (field.type) {
+            case CsvField::Integer:
+                sqlite3_bind_int64(stmt, index, field.integer);
+                break;
+            case CsvField::Real:
+                sqlite3_bind_double(stmt, index, field.real);
+                break;
+            case CsvField::Text:
+                // The chunk outlives the step
+                sqlite3_bind_text(stmt, index, chunk.bytes.data() + field.offset, static_cast<int>(field.length),
+                                  SQLITE_STATIC);
+                break;
+            default:
+                sqlite3_bind_null(stmt, index);
+                break;
+            }
+        }
+        int rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (rc != SQLITE_DONE) {
+            *error = sqlite3_errmsg(sqlite3_db_handle(stmt));
+            return false;
+        }
+        (*rows)++;
+        begin = end;
+    }
+    return true;
+}
+
+bool CsvImport::Run(sqlite3* db, const std::string& table, uint64_t* rows, std::string* error) {
+    // The first chunk is parsed here, since it decides the columns
+    std::unique_ptr<CsvChunk> first = ReadChunk();
+    if (!first) {
+        *error = read_error_;
+        return read_error_.empty();
+    }
+    ParseChunk(*first, options_.delimiter);
+    if (first->record_ends.empty()) {
+        return true;
+    }
+    size_t columns = first->record_ends[0];
+
+    std::string sql = "INSERT INTO ";
+    AppendIdentifier(sql, table.data(), table.size());
+    if (options_.header) {
+        sql += " (";
+        for (size_t c = 0; c < columns; c++) {
+            const CsvField& field = first->fields[c];
+            if (c > 0) {
+                sql += ", ";
+            }
+            AppendIdentifier(sql, first->bytes.data() + field.offset, field.length);
+        }
+        sql += ")";
+    }
+    sql += " VALUES (";
+    for (size_t c = 0; c < columns; c++) {
+        sql += c > 0 ? ", ?" : "?";
+    }
+    sql += ")";
+
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), static_cast<int>(sql.size()), &stmt, nullptr) != SQLITE_OK) {
+        *error = sqlite3_errmsg(db);
+        return false;
+    }
+    // A savepoint opens a transaction when none is open, and nests otherwise
+    if (sqlite3_exec(db, "SAVEPOINT mo_betta_import", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        *error = sqlite3_errmsg(db);
+        sqlite3_finalize(stmt);
+        return false;
+    }
+
+    unsigned threads = options_.threads;
+    if (threads == 0) {
+        unsigned cores = std::thread::hardware_concurrency();
+        threads = std::clamp(cores > 1 ? cores - 1 : 1u, 1u, kMaxParsers);
+    }
+    in_flight_limit_ = 2 * threads;
+    parsers_running_ = threads;
+    std::vector<std::thread> parsers;
+    for (unsigned i = 0; i < threads; i++) {
+        parsers.emplace_back(&CsvImport::Parse, this);
+    }
+
+    uint64_t record = 0;
+    bool ok = Insert(stmt, *first, options_.header ? 1 : 0, columns, &record, rows, error);
+    first.reset();
+    for (size_t sequence = 1; ok; sequence++) {
+        std::unique_ptr<CsvChunk> chunk = NextParsed(sequence);
+        if (!chunk) {
+            break;
+        }
+        ok = Insert(stmt, *chunk, 0, columns, &record, rows, error);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            in_flight_--;
+        }
+        inserted_.notify_one();
+    }
+    Stop(parsers);
+    sqlite3_finalize(stmt);
+
+    if (ok && !read_error_.empty()) {
+        *error = read_error_;
+        ok = false;
+    }
+    if (ok && sqlite3_exec(db, "RELEASE mo_betta_import", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        *error = sqlite3_errmsg(db);
+        ok = false;
+    }
+    if (!ok) {
+        sqlite3_exec(db, "ROLLBACK TO mo_betta_import", nullptr, nullptr, nullptr);
+        sqlite3_exec(db, "RELEASE mo_betta_import", nullptr, nullptr, nullptr);
+        *rows = 0;
+    }
+    return ok;
+}
+
+bool ImportCsv(sqlite3* db, const std::string& path, const std::string& table, const CsvImportOptions& options,
+               uint64_t* rows, std::string* error) {
+    *rows = 0;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = "Cannot open " + path + ": " + strerror(errno);
+        return false;
+    }
+    CsvImport import(fd, options);
+    bool ok = import.Run(db, table, rows, error);
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <cstdint>
+#include <string>
+
+struct CsvImportOptions {
+    char delimiter = ',';
+    // Whether the first record names the columns to insert into. Without
+    // it, records fill the table's columns in order.
+    bool header = true;
+    // Parser threads; 0 picks one per spare core
+    unsigned threads = 0;
+};
+
+// Inserts the records of a CSV file into `table` in one transaction (a
+// savepoint if one is already open), rolled back on any error.
+//
+// The file is read in chunks of whole records, which parser threads split
+// into fields and convert to integers and reals where that loses nothing;
+// other fields are bound as text and left to the column's affinity. This
+// thread binds and steps one prepared INSERT per record, in file order.
+// Touches no V8 state; runs on the threadpool while it owns the connection.
+// Returns false and sets `error` on failure.
+bool ImportCsv(sqlite3* db, const std::string& path, const std::string& table, const CsvImportOptions& options,
+               uint64_t* rows, std::string* error);
@@ -1,27 +1,73 @@
 #include "database.h"
+#include "addon_data.h"
+#include "async_work.h"
+#include "blob_handle.h"
+#include "csv_import.h"
 #include "statement.h"
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <vector>
 
+// Enough for the distinct queries of a typical application
+static constexpr size_t kDefaultStatementCacheSize = 128;
+
+// Nested transactions all use the same savepoint name; RELEASE and
+// ROLLBACK TO act on the innermost one
+static const char* const kControlStatementSql[] = {
+    "BEGIN",
+    "BEGIN IMMEDIATE",
+    "BEGIN EXCLUSIVE",
+    "COMMIT",
+    "ROLLBACK",
+    "SAVEPOINT mo_betta_transaction",
+    "RELEASE mo_betta_transaction",
+    "ROLLBACK TO mo_betta_transaction",
+};
+
+using v8::Array;
 using v8::Context;
 using v8::Exception;
 using v8::External;
 using v8::Function;
 using v8::FunctionCallbackInfo;
 using v8::FunctionTemplate;
+using v8::Integer;
 using v8::Isolate;
 using v8::Local;
+using v8::MaybeLocal;
 using v8::NewStringType;
+using v8::Number;
 using v8::Object;
-using v8::Persistent;
 using v8::String;
 using v8::Value;
 
-Persistent<Function> Database::constructor;
+// Reads the encoding the file ended up with, which for an existing file
+// may differ from the one that was asked for
+static int QueryTextEncoding(sqlite3* db, TextEncoding* encoding) {
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, "PRAGMA encoding", -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        *encoding = name && strcmp(name, "UTF-8") == 0 ? TextEncoding::Utf8 : TextEncoding::Utf16;
+        rc = SQLITE_OK;
+    }
+    sqlite3_finalize(stmt);
+    return rc;
+}
 
-Database::Database(const char* filename) : db_(nullptr) {
-    int rc = sqlite3_open_v2(filename, &db_, 
-        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr);
+Database::Database(const char* filename, bool readonly, size_t statement_cache_size, const char* encoding,
+                   AddonData* addon_data)
+    : db_(nullptr), addon_data_(addon_data), text_encoding_(TextEncoding::Utf16), statement_cache_(statement_cache_size),
+      collected_(false), running_work_(nullptr), control_statements_(), transaction_depth_(0) {
+    int flags = readonly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    int rc = sqlite3_open_v2(filename, &db_, flags | SQLITE_OPEN_NOMUTEX, nullptr);
     
     if (rc != SQLITE_OK) {
         std::string error = "Cannot open database: ";
@@ -35,10 +81,21 @@ Database::Database(const char* filename) : db_(nullptr) {
         throw std::runtime_error(error);
     }
 
-    // Set pragma to use UTF-16 encoding for text
-    rc = sqlite3_exec(db_, "PRAGMA encoding = 'UTF-16'", nullptr, nullptr, nullptr);
+    if (encoding) {
+        std::string pragma = std::string("PRAGMA encoding = '") + encoding + "'";
+        rc = sqlite3_exec(db_, pragma.c_str(), nullptr, nullptr, nullptr);
+        if (rc != SQLITE_OK) {
+            std::string error = std::string("Cannot set ") + encoding + " encoding: ";
+            error += sqlite3_errmsg(db_);
+            sqlite3_close(db_);
+            db_ = nullptr;
+            throw std::runtime_error(error);
+        }
+    }
+
+    rc = QueryTextEncoding(db_, &text_encoding_);
     if (rc != SQLITE_OK) {
-        std::string error = "Cannot set UTF-16 encoding: ";
+        std::string error = "Cannot read database encoding: ";
         error += sqlite3_errmsg(db_);
         sqlite3_close(db_);
         db_ = nullptr;
@@ -47,26 +104,55 @@ Database::Database(const char* filename) : db_(nullptr) {
 }
 
 Database::~Database() {
-    if (db_) {
-        sqlite3_close(db_);
-        db_ = nullptr;
+    CloseConnection();
+    for (Statement* statement : statements_) {
+        delete statement;
+    }
+    for (BlobHandle* blob : blobs_) {
+        delete blob;
+    }
+    addon_data_->databases.erase(this);
+}
+
+// Finalizes every handle of the connection, including those of live
+// Statement objects, which then behave as if finalize() had been called,
+// and closes open BLOBs.
+// sqlite3_close_v2 takes care of anything else still open.
+void Database::CloseConnection() {
+    if (!db_) {
+        return;
+    }
+    for (Statement* statement : statements_) {
+        statement->Invalidate();
     }
+    for (BlobHandle* blob : blobs_) {
+        blob->Invalidate();
+    }
+    statement_cache_.Clear();
+    FinalizeControlStatements();
+    sqlite3_close_v2(db_);
+    db_ = nullptr;
 }
 
-void Database::Init(Local<Object> exports) {
+void Database::Init(Local<Object> exports, AddonData* addon_data) {
     Isolate* isolate = exports->GetIsolate();
     Local<Context> context = isolate->GetCurrentContext();
 
-    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, New);
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, New, External::New(isolate, addon_data));
     tpl->SetClassName(String::NewFromUtf8(isolate, "Database", NewStringType::kNormal).ToLocalChecked());
     tpl->InstanceTemplate()->SetInternalFieldCount(1);
 
     NODE_SET_PROTOTYPE_METHOD(tpl, "prepare", Prepare);
     NODE_SET_PROTOTYPE_METHOD(tpl, "exec", Exec);
     NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "execAsync", ExecAsync);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "cacheStats", CacheStats);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "transaction", Transaction);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "openBlob", OpenBlob);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "importCsv", ImportCsv);
 
     Local<Function> constructor_local = tpl->GetFunction(context).ToLocalChecked();
-    constructor.Reset(isolate, constructor_local);
+    addon_data->database_constructor.Reset(isolate, constructor_local);
     exports->Set(context, String::NewFromUtf8(isolate, "Database", NewStringType::kNormal).ToLocalChecked(),
                 constructor_local).FromJust();
 }
@@ -82,10 +168,56 @@ void Database::New(const FunctionCallbackInfo<Value>& args) {
             return;
         }
 
+        AddonData* addon_data = AddonData::From(args);
+        bool readonly = false;
+        size_t statement_cache_size = kDefaultStatementCacheSize;
+        const char* encoding = "UTF-16";
+        if (args.Length() > 1 && args[1]->IsObject()) {
+            Local<Object> options = args[1].As<Object>();
+            Local<Value> value;
+            if (!options->Get(context, addon_data->readonly_string.Get(isolate)).ToLocal(&value)) {
+                return;
+            }
+            readonly = value->BooleanValue(isolate);
+
+            if (!options->Get(context, addon_data->statement_cache_size_string.Get(isolate)).ToLocal(&value)) {
+                return;
+            }
+            if (!value->IsUndefined()) {
+                double size = value->IsNumber() ? value.As<Number>()->Value() : -1;
+                if (!(size >= 0 && size <= UINT32_MAX) || size != static_cast<double>(static_cast<uint32_t>(size))) {
+                    isolate->ThrowException(Exception::RangeError(
+                        String::NewFromUtf8(isolate, "statementCacheSize must be a non-negative integer", NewStringType::kNormal).ToLocalChecked()));
+                    return;
+                }
+                statement_cache_size = static_cast<size_t>(size);
+            }
+
+            if (!options->Get(context, addon_data->encoding_string.Get(isolate)).ToLocal(&value)) {
+                return;
+            }
+            if (!value->IsUndefined()) {
+                String::Utf8Value name(isolate, value);
+                std::string_view choice = value->IsString() && *name ? *name : "";
+                if (choice == "utf16") {
+                    encoding = "UTF-16";
+                } else if (choice == "utf8") {
+                    encoding = "UTF-8";
+                } else if (choice == "auto") {
+                    encoding = nullptr;
+                } else {
+                    isolate->ThrowException(Exception::TypeError(
+                        String::NewFromUtf8(isolate, "encoding must be 'auto', 'utf8' or 'utf16'", NewStringType::kNormal).ToLocalChecked()));
+                    return;
+                }
+            }
+        }
+
         String::Utf8Value path(isolate, args[0]);
         
         try {
-            Database* obj = new Database(*path);
+            Database* obj = new Database(*path, readonly, statement_cache_size, encoding, addon_data);
+            addon_data->databases.insert(obj);
             obj->Wrap(args.This());
             args.GetReturnValue().Set(args.This());
         } catch (const std::exception& e) {
@@ -93,9 +225,9 @@ void Database::New(const FunctionCallbackInfo<Value>& args) {
                 String::NewFromUtf8(isolate, e.what(), NewStringType::kNormal).ToLocalChecked()));
         }
     } else {
-        const int argc = 1;
-        Local<Value> argv[argc] = { args[0] };
-        Local<Function> cons = Local<Function>::New(isolate, constructor);
+        const int argc = 2;
+        Local<Value> argv[argc] = { args[0], args[1] };
+        Local<Function> cons = AddonData::From(args)->database_constructor.Get(isolate);
         Local<Object> result = cons->NewInstance(context, argc, argv).ToLocalChecked();
         args.GetReturnValue().Set(result);
     }
@@ -111,24 +243,34 @@ void Database::Prepare(const FunctionCallbackInfo<Value>& args) {
         return;
     }
 
+    if (db->IsBusy()) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is busy with an asynchronous operation", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
     if (args.Length() < 1 || !args[0]->IsString()) {
         isolate->ThrowException(Exception::TypeError(
             String::NewFromUtf8(isolate, "SQL string required", NewStringType::kNormal).ToLocalChecked()));
         return;
     }
 
-    String::Utf8Value sql(isolate, args[0]);
-    
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v3(db->db_, *sql, -1, 0, &stmt, nullptr);
-    
-    if (rc != SQLITE_OK) {
-        isolate->ThrowException(Exception::Error(
-            String::NewFromUtf8(isolate, sqlite3_errmsg(db->db_), NewStringType::kNormal).ToLocalChecked()));
-        return;
+    Local<String> sql = args[0].As<String>();
+    sqlite3_stmt* stmt = db->statement_cache_.Take(isolate, sql);
+
+    if (!stmt) {
+        String::Utf8Value utf8(isolate, sql);
+        unsigned int flags = db->statement_cache_.Capacity() > 0 ? SQLITE_PREPARE_PERSISTENT : 0;
+        int rc = sqlite3_prepare_v3(db->db_, *utf8, -1, flags, &stmt, nullptr);
+
+        if (rc != SQLITE_OK) {
+            isolate->ThrowException(Exception::Error(
+                String::NewFromUtf8(isolate, sqlite3_errmsg(db->db_), NewStringType::kNormal).ToLocalChecked()));
+            return;
+        }
     }
 
-    args.GetReturnValue().Set(Statement::NewInstance(isolate, stmt, db));
+    args.GetReturnValue().Set(Statement::NewInstance(isolate, stmt, db, args.Holder(), sql));
 }
 
 void Database::Exec(const FunctionCallbackInfo<Value>& args) {
@@ -141,6 +283,12 @@ void Database::Exec(const FunctionCallbackInfo<Value>& args) {
         return;
     }
 
+    if (db->IsBusy()) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is busy with an asynchronous operation", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
     if (args.Length() < 1 || !args[0]->IsString()) {
         isolate->ThrowException(Exception::TypeError(
             String::NewFromUtf8(isolate, "SQL string required", NewStringType::kNormal).ToLocalChecked()));
@@ -162,18 +310,483 @@ void Database::Exec(const FunctionCallbackInfo<Value>& args) {
 }
 
 void Database::Close(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+
+    // Work waiting for a transaction function to finish still needs the
+    // connection
+    Database* db = Unwrap(args.Holder());
+    if (db && (db->IsBusy() || !db->pending_work_.empty())) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is busy with an asynchronous operation", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+    if (db) {
+        db->CloseConnection();
+    }
+}
+
+// openBlob(table, column, rowid, options) opens the BLOB in that cell for
+// incremental reads and writes. Writable unless options.readonly is set.
+void Database::OpenBlob(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Database* db = Unwrap(args.Holder());
+    if (!db || !db->IsOpen()) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is closed", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    if (db->IsBusy()) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is busy with an asynchronous operation", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    if (args.Length() < 2 || !args[0]->IsString() || !args[1]->IsString()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Table and column names required", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    sqlite3_int64 rowid;
+    if (!RowidFromJS(isolate, args[2], &rowid)) {
+        return;
+    }
+
+    bool readonly = false;
+    if (args.Length() > 3 && args[3]->IsObject()) {
+        Local<Value> value;
+        if (!args[3].As<Object>()->Get(context, db->addon_data_->readonly_string.Get(isolate)).ToLocal(&value)) {
+            return;
+        }
+        readonly = value->BooleanValue(isolate);
+    }
+
+    String::Utf8Value table(isolate, args[0]);
+    String::Utf8Value column(isolate, args[1]);
+    sqlite3_blob* blob;
+    int rc = sqlite3_blob_open(db->db_, "main", *table, *column, rowid, readonly ? 0 : 1, &blob);
+    if (rc != SQLITE_OK) {
+        // The handle is set even on failure, except when out of memory
+        sqlite3_blob_close(blob);
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, sqlite3_errmsg(db->db_), NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    args.GetReturnValue().Set(BlobHandle::NewInstance(isolate, blob, db, args.Holder()));
+}
+
+class ExecWork : public AsyncWork {
+public:
+    ExecWork(Isolate* isolate, Database* db, Local<Object> owner, std::string sql)
+        : AsyncWork(isolate, db, owner, "mo-betta-sqlite3:exec"), sql_(std::move(sql)) {}
+
+protected:
+    void Execute() override {
+        char* errMsg = nullptr;
+        int rc = sqlite3_exec(db_->GetDb(), sql_.c_str(), nullptr, nullptr, &errMsg);
+        if (rc != SQLITE_OK) {
+            error_ = errMsg ? errMsg : "Unknown error";
+            if (errMsg) sqlite3_free(errMsg);
+        }
+    }
+
+    Local<Value> Complete(Isolate* isolate) override {
+        return v8::Undefined(isolate);
+    }
+
+private:
+    std::string sql_;
+};
+
+void Database::ExecAsync(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+
     Database* db = Unwrap(args.Holder());
-    if (db && db->db_) {
-        sqlite3_close(db->db_);
-        db->db_ = nullptr;
+    if (!db || !db->IsOpen()) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is closed", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    if (args.Length() < 1 || !args[0]->IsString()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "SQL string required", NewStringType::kNormal).ToLocalChecked()));
+        return;
     }
+
+    String::Utf8Value sql(isolate, args[0]);
+
+    auto work = new ExecWork(isolate, db, args.Holder(), std::string(*sql, sql.length()));
+    args.GetReturnValue().Set(work->GetPromise(isolate));
+    db->Schedule(work);
+}
+
+class ImportCsvWork : public AsyncWork {
+public:
+    ImportCsvWork(Isolate* isolate, Database* db, Local<Object> owner, std::string path, std::string table,
+                  const CsvImportOptions& options)
+        : AsyncWork(isolate, db, owner, "mo-betta-sqlite3:importCsv"), path_(std::move(path)),
+          table_(std::move(table)), options_(options), rows_(0) {}
+
+protected:
+    void Execute() override {
+        ::ImportCsv(db_->GetDb(), path_, table_, options_, &rows_, &error_);
+    }
+
+    Local<Value> Complete(Isolate* isolate) override {
+        return Number::New(isolate, static_cast<double>(rows_));
+    }
+
+private:
+    std::string path_;
+    std::string table_;
+    CsvImportOptions options_;
+    uint64_t rows_;
+};
+
+// importCsv(path, table, { delimiter, header, threads }) resolves with the
+// number of rows inserted
+void Database::ImportCsv(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Database* db = Unwrap(args.Holder());
+    if (!db || !db->IsOpen()) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is closed", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    if (args.Length() < 2 || !args[0]->IsString() || !args[1]->IsString()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "File path and table name required", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    CsvImportOptions options;
+    if (args.Length() > 2 && args[2]->IsObject()) {
+        Local<Object> object = args[2].As<Object>();
+        Local<Value> value;
+        if (!object->Get(context, String::NewFromUtf8(isolate, "delimiter", NewStringType::kInternalized).ToLocalChecked()).ToLocal(&value)) {
+            return;
+        }
+        if (!value->IsUndefined()) {
+            String::Utf8Value delimiter(isolate, value);
+            if (!value->IsString() || delimiter.length() != 1 || strchr("\"\r\n", (*delimiter)[0])) {
+                isolate->ThrowException(Exception::TypeError(
+                    String::NewFromUtf8(isolate, "delimiter must be a single ASCII character other than a quote or line break", NewStringType::kNormal).ToLocalChecked()));
+                return;
+            }
+            options.delimiter = (*delimiter)[0];
+        }
+
+        if (!object->Get(context, String::NewFromUtf8(isolate, "header", NewStringType::kInternalized).ToLocalChecked()).ToLocal(&value)) {
+            return;
+        }
+        if (!value->IsUndefined()) {
+            options.header = value->BooleanValue(isolate);
+        }
+
+        if (!object->Get(context, String::NewFromUtf8(isolate, "threads", NewStringType::kInternalized).ToLocalChecked()).ToLocal(&value)) {
+            return;
+        }
+        if (!value->IsUndefined()) {
+            double threads = value->IsNumber() ? value.As<Number>()->Value() : 0;
+            if (!(threads >= 1 && threads <= 64) || threads != static_cast<double>(static_cast<unsigned>(threads))) {
+                isolate->ThrowException(Exception::RangeError(
+                    String::NewFromUtf8(isolate, "threads must be an integer from 1 to 64", NewStringType::kNormal).ToLocalChecked()));
+                return;
+            }
+            options.threads = static_cast<unsigned>(threads);
+        }
+    }
+
+    String::Utf8Value path(isolate, args[0]);
+    String::Utf8Value table(isolate, args[1]);
+
+    auto work = new ImportCsvWork(isolate, db, args.Holder(), std::string(*path, path.length()),
+                                  std::string(*table, table.length()), options);
+    args.GetReturnValue().Set(work->GetPromise(isolate));
+    db->Schedule(work);
+}
+
+void Database::CacheStats(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Database* db = Unwrap(args.Holder());
+    const StatementCache& cache = db->statement_cache_;
+
+    Local<Object> stats = Object::New(isolate);
+    stats->Set(context, String::NewFromUtf8(isolate, "hits", NewStringType::kInternalized).ToLocalChecked(),
+               Number::New(isolate, static_cast<double>(cache.Hits()))).Check();
+    stats->Set(context, String::NewFromUtf8(isolate, "misses", NewStringType::kInternalized).ToLocalChecked(),
+               Number::New(isolate, static_cast<double>(cache.Misses()))).Check();
+    stats->Set(context, String::NewFromUtf8(isolate, "size", NewStringType::kInternalized).ToLocalChecked(),
+               Number::New(isolate, static_cast<double>(cache.Size()))).Check();
+    stats->Set(context, String::NewFromUtf8(isolate, "capacity", NewStringType::kInternalized).ToLocalChecked(),
+               Number::New(isolate, static_cast<double>(cache.Capacity()))).Check();
+    args.GetReturnValue().Set(stats);
+}
+
+// Returns a function that runs `fn` in a transaction, with .deferred,
+// .immediate and .exclusive variants for the different BEGIN modes
+void Database::Transaction(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    if (args.Length() < 1 || !args[0]->IsFunction()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Transaction function required", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    const char* names[] = {"deferred", "immediate", "exclusive"};
+    const ControlStatement modes[] = {kBegin, kBeginImmediate, kBeginExclusive};
+    Local<Function> variants[3];
+
+    for (int i = 0; i < 3; i++) {
+        Local<Value> data[] = {args.Holder(), args[0], Integer::New(isolate, modes[i])};
+        if (!Function::New(context, TransactionCall, Array::New(isolate, data, 3)).ToLocal(&variants[i])) {
+            return;
+        }
+    }
+    for (auto& variant : variants) {
+        for (int i = 0; i < 3; i++) {
+            variant->Set(context, String::NewFromUtf8(isolate, names[i], NewStringType::kInternalized).ToLocalChecked(),
+                         variants[i]).Check();
+        }
+    }
+
+    args.GetReturnValue().Set(variants[0]);
+}
+
+void Database::TransactionCall(const FunctionCallbackInfo<Value>& args) {
+    Isolate* isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Local<Array> data = args.Data().As<Array>();
+    Database* db = Unwrap(data->Get(context, 0).ToLocalChecked().As<Object>());
+    Local<Function> fn = data->Get(context, 1).ToLocalChecked().As<Function>();
+    auto begin = static_cast<ControlStatement>(data->Get(context, 2).ToLocalChecked().As<Integer>()->Value());
+
+    if (!db->IsOpen()) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is closed", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    if (db->running_work_) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is busy with an asynchronous operation", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    bool nested;
+    if (!db->BeginTransaction(isolate, begin, &nested)) {
+        return;
+    }
+
+    std::vector<Local<Value>> argv(args.Length());
+    for (int i = 0; i < args.Length(); i++) {
+        argv[i] = args[i];
+    }
+
+    db->transaction_depth_++;
+    MaybeLocal<Value> result = fn->Call(context, args.This(), static_cast<int>(argv.size()), argv.data());
+    db->transaction_depth_--;
+
+    Local<Value> value;
+    if (result.ToLocal(&value) && db->IsOpen() && db->CommitTransaction(isolate, nested)) {
+        args.GetReturnValue().Set(value);
+    } else if (db->IsOpen()) {
+        db->RollbackTransaction(nested);
+    }
+
+    if (db->transaction_depth_ == 0 && !db->running_work_) {
+        db->StartNextWork();
+    }
+}
+
+bool Database::BeginTransaction(Isolate* isolate, ControlStatement begin, bool* nested) {
+    // Inside a transaction, whether or not it was opened by this API,
+    // nesting maps to a savepoint
+    *nested = !sqlite3_get_autocommit(db_);
+    return RunControlStatement(isolate, *nested ? kSavepoint : begin);
+}
+
+bool Database::CommitTransaction(Isolate* isolate, bool nested) {
+    return RunControlStatement(isolate, nested ? kRelease : kCommit);
+}
+
+void Database::RollbackTransaction(bool nested) {
+    // Some errors already roll back the whole transaction; otherwise undo
+    // this level. Errors are ignored, the caller reports the original one.
+    if (sqlite3_get_autocommit(db_)) {
+        return;
+    }
+    if (nested) {
+        sqlite3_step(control_statements_[kRollbackTo]);
+        sqlite3_reset(control_statements_[kRollbackTo]);
+        sqlite3_step(control_statements_[kRelease]);
+        sqlite3_reset(control_statements_[kRelease]);
+    } else {
+        sqlite3_step(control_statements_[kRollback]);
+        sqlite3_reset(control_statements_[kRollback]);
+    }
+}
+
+bool Database::RunControlStatement(Isolate* isolate, ControlStatement which) {
+    // All of them are prepared together on first use, so that the rollback
+    // path never has to prepare anything
+    if (!control_statements_[kBegin]) {
+        for (int i = 0; i < kControlStatementCount; i++) {
+            int rc = sqlite3_prepare_v3(db_, kControlStatementSql[i], -1, SQLITE_PREPARE_PERSISTENT,
+                                        &control_statements_[i], nullptr);
+            if (rc != SQLITE_OK) {
+                isolate->ThrowException(Exception::Error(
+                    String::NewFromUtf8(isolate, sqlite3_errmsg(db_), NewStringType::kNormal).ToLocalChecked()));
+                FinalizeControlStatements();
+                return false;
+            }
+        }
+    }
+
+    sqlite3_stmt* stmt = control_statements_[which];
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, sqlite3_errmsg(db_), NewStringType::kNormal).ToLocalChecked()));
+        sqlite3_reset(stmt);
+        return false;
+    }
+    sqlite3_reset(stmt);
+    return true;
+}
+
+void Database::FinalizeControlStatements() {
+    for (auto& stmt : control_statements_) {
+        sqlite3_finalize(stmt);
+        stmt = nullptr;
+    }
+}
+
+void Database::ReleaseStatement(Isolate* isolate, Local<String> sql, sqlite3_stmt* stmt) {
+    if (running_work_) {
+        orphaned_statements_.push_back(stmt);
+    } else if (db_) {
+        statement_cache_.Put(isolate, sql, stmt);
+    } else {
+        sqlite3_finalize(stmt);
+    }
+}
+
+void Database::RegisterStatement(Statement* statement) {
+    statements_.insert(statement);
+}
+
+void Database::UnregisterStatement(Statement* statement) {
+    statements_.erase(statement);
+    if (collected_ && statements_.empty() && blobs_.empty()) {
+        delete this;
+    }
+}
+
+void Database::RegisterBlob(BlobHandle* blob) {
+    blobs_.insert(blob);
+}
+
+void Database::UnregisterBlob(BlobHandle* blob) {
+    blobs_.erase(blob);
+    if (collected_ && statements_.empty() && blobs_.empty()) {
+        delete this;
+    }
+}
+
+void Database::ReleaseBlob(sqlite3_blob* blob) {
+    if (running_work_) {
+        orphaned_blobs_.push_back(blob);
+    } else {
+        sqlite3_blob_close(blob);
+    }
+}
+
+void Database::Schedule(AsyncWork* work) {
+    pending_work_.push_back(work);
+    if (!running_work_ && transaction_depth_ == 0) {
+        StartNextWork();
+    }
+}
+
+void Database::CancelWork() {
+    for (AsyncWork* work : pending_work_) {
+        delete work;
+    }
+    pending_work_.clear();
+    if (running_work_) {
+        running_work_->Cancel();
+        sqlite3_interrupt(db_);
+    }
+}
+
+void Database::StartNextWork() {
+    while (!pending_work_.empty()) {
+        running_work_ = pending_work_.front();
+        pending_work_.pop_front();
+        if (running_work_->Start()) {
+            return;
+        }
+        // Setup failed and already rejected the promise
+        delete running_work_;
+        running_work_ = nullptr;
+    }
+}
+
+void Database::FinishWork(AsyncWork* work) {
+    running_work_ = nullptr;
+    delete work;
+    for (sqlite3_stmt* stmt : orphaned_statements_) {
+        sqlite3_finalize(stmt);
+    }
+    orphaned_statements_.clear();
+    for (sqlite3_blob* blob : orphaned_blobs_) {
+        sqlite3_blob_close(blob);
+    }
+    orphaned_blobs_.clear();
+    // May free this database along with the addon instance
+    if (addon_data_->tearing_down) {
+        addon_data_->WorkFinished();
+        return;
+    }
+    StartNextWork();
 }
 
 Database* Database::Unwrap(Local<Object> obj) {
-    Local<External> external = Local<External>::Cast(obj->GetInternalField(0));
-    return static_cast<Database*>(external->Value());
+    return static_cast<Database*>(obj->GetAlignedPointerFromInternalField(0));
 }
 
 void Database::Wrap(Local<Object> obj) {
-    obj->SetInternalField(0, v8::External::New(obj->GetIsolate(), this));
+    obj->SetAlignedPointerInInternalField(0, this);
+    handle_.Reset(obj->GetIsolate(), obj);
+    handle_.SetWeak(this, WeakCallback, v8::WeakCallbackType::kParameter);
+}
+
+void Database::WeakCallback(const v8::WeakCallbackInfo<Database>& info) {
+    info.GetParameter()->handle_.Reset();
+    info.SetSecondPassCallback(Collect);
+}
+
+// Queued and running work holds the JS object, so a collected database
+// never has work in flight
+void Database::Collect(const v8::WeakCallbackInfo<Database>& info) {
+    Database* db = info.GetParameter();
+    if (db->statements_.empty() && db->blobs_.empty()) {
+        delete db;
+    } else {
+        db->collected_ = true;
+    }
 }
@@ -3,25 +3,132 @@
 #include <v8.h>
 #include <node.h>
 #include <sqlite3.h>
+#include <deque>
 #include <memory>
+#include <unordered_set>
+#include <vector>
+#include "statement_cache.h"
+#include "text_encoding.h"
+
+class AsyncWork;
+class BlobHandle;
+class Statement;
+struct AddonData;
 
 class Database {
 public:
-    static void Init(v8::Local<v8::Object> exports);
+    static void Init(v8::Local<v8::Object> exports, AddonData* addon_data);
     static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void Prepare(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void Exec(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void Close(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void ExecAsync(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void CacheStats(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Transaction(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void OpenBlob(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void ImportCsv(const v8::FunctionCallbackInfo<v8::Value>& args);
 
     sqlite3* GetDb() const { return db_; }
     bool IsOpen() const { return db_ != nullptr; }
+    AddonData* GetAddonData() const { return addon_data_; }
+    // The encoding the database file stores text in
+    TextEncoding GetTextEncoding() const { return text_encoding_; }
 
-private:
-    Database(const char* filename);
+    // While asynchronous work is queued or running the connection belongs
+    // to it, and synchronous calls must not touch the handle. Work queued
+    // inside a transaction function only starts after it, so until then the
+    // function keeps using the connection.
+    bool IsBusy() const { return running_work_ != nullptr || (!pending_work_.empty() && transaction_depth_ == 0); }
+    void Schedule(AsyncWork* work);
+
+    // For environment teardown: drops queued work without settling it and
+    // interrupts the running work, which still has to come back from the
+    // threadpool before the connection can be closed
+    void CancelWork();
+    bool HasRunningWork() const { return running_work_ != nullptr; }
+
+    // Statements that open and close transactions, prepared on first use
+    enum ControlStatement {
+        kBegin,
+        kBeginImmediate,
+        kBeginExclusive,
+        kCommit,
+        kRollback,
+        kSavepoint,
+        kRelease,
+        kRollbackTo,
+        kControlStatementCount
+    };
+
+    // Opens a transaction with `begin`, or a savepoint when one is already
+    // open. Commit and rollback close whichever was opened. Begin and
+    // commit return false with a pending exception.
+    bool BeginTransaction(v8::Isolate* isolate, ControlStatement begin, bool* nested);
+    bool CommitTransaction(v8::Isolate* isolate, bool nested);
+    void RollbackTransaction(bool nested);
+
+    // Takes back a statement from Prepare() once its Statement is finalized
+    // or collected. While async work runs the handle is only finalized
+    // when that work has finished.
+    void ReleaseStatement(v8::Isolate* isolate, v8::Local<v8::String> sql, sqlite3_stmt* stmt);
+
+    // Live Statement objects, so that closing the connection can finalize
+    // their handles. A statement keeps its database's JS object alive, so
+    // the database is only collected together with its last statements.
+    void RegisterStatement(Statement* statement);
+    void UnregisterStatement(Statement* statement);
+
+    // The same for open BLOBs, which are closed along with the connection
+    void RegisterBlob(BlobHandle* blob);
+    void UnregisterBlob(BlobHandle* blob);
+    // Closes the handle of a collected BlobHandle, once async work is done
+    void ReleaseBlob(sqlite3_blob* blob);
+
+    // Also deletes the Statement and BlobHandle objects that are still
+    // registered; only used when the addon instance is torn down
     ~Database();
 
-    static v8::Persistent<v8::Function> constructor;
+private:
+    // `encoding` is applied with PRAGMA encoding when not null, which only
+    // takes effect on a new file
+    Database(const char* filename, bool readonly, size_t statement_cache_size, const char* encoding,
+             AddonData* addon_data);
+
     sqlite3* db_;
+    AddonData* addon_data_;
+    TextEncoding text_encoding_;
+    StatementCache statement_cache_;
+
+    v8::Global<v8::Object> handle_;
+    std::unordered_set<Statement*> statements_;
+    std::unordered_set<BlobHandle*> blobs_;
+    // Set once the JS object is garbage collected while statements and
+    // BLOBs collected in the same cycle are still waiting for their
+    // finalizers
+    bool collected_;
+
+    std::deque<AsyncWork*> pending_work_;
+    AsyncWork* running_work_;
+    std::vector<sqlite3_stmt*> orphaned_statements_;
+    std::vector<sqlite3_blob*> orphaned_blobs_;
+
+    sqlite3_stmt* control_statements_[kControlStatementCount];
+
+    // Depth of transaction functions on the stack. Async work scheduled
+    // from inside one only starts once the outermost has finished.
+    int transaction_depth_;
+
+    static void TransactionCall(const v8::FunctionCallbackInfo<v8::Value>& args);
+    bool RunControlStatement(v8::Isolate* isolate, ControlStatement which);
+    void FinalizeControlStatements();
+    void CloseConnection();
+
+    static void WeakCallback(const v8::WeakCallbackInfo<Database>& info);
+    static void Collect(const v8::WeakCallbackInfo<Database>& info);
+
+    friend class AsyncWork;
+    void StartNextWork();
+    void FinishWork(AsyncWork* work);
     
     static Database* Unwrap(v8::Local<v8::Object> obj);
     void Wrap(v8::Local<v8::Object> obj);
@@ -1,18 +1,113 @@
 #include "external_string.h"
+#include <cstring>
+#include <new>
 
-SQLiteExternalString::SQLiteExternalString(const uint16_t* data, size_t length)
-    : data_(data), length_(length) {
+// Slabs are shared by all rows of a batch; text that would take up more
+// than a quarter of one gets a dedicated slab sized to fit.
+static constexpr size_t kSlabCapacity = 64 * 1024;
+static constexpr size_t kDedicatedThreshold = kSlabCapacity / 4;
+
+TextSlab* TextSlab::Create(size_t capacity) {
+    void* memory = ::operator new(sizeof(TextSlab) + capacity);
+    return new (memory) TextSlab(capacity);
+}
+
+TextSlab::TextSlab(size_t capacity) : refs_(1), capacity_(capacity), used_(0) {
+}
+
+void TextSlab::Retain() {
+    refs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TextSlab::Release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        this->~TextSlab();
+        ::operator delete(this);
+    }
+}
+
+void* TextSlab::Allocate(size_t bytes) {
+    // One-byte text may leave the end at an odd offset
+    size_t start = (used_ + 1) & ~static_cast<size_t>(1);
+    if (start > capacity_ || capacity_ - start < bytes) {
+        return nullptr;
+    }
+    used_ = start + bytes;
+    return data() + start;
+}
+
+void TextSlab::Shrink(size_t bytes) {
+    used_ -= bytes;
+}
+
+RowArena::~RowArena() {
+    Reset();
+}
+
+void* RowArena::Allocate(size_t bytes, TextSlab** slab) {
+    if (bytes > kDedicatedThreshold) {
+        // The creation reference is the one handed to the caller
+        TextSlab* dedicated = TextSlab::Create(bytes);
+        *slab = dedicated;
+        return dedicated->Allocate(bytes);
+    }
+
+    void* space = current_ ? current_->Allocate(bytes) : nullptr;
+    if (!space) {
+        Reset();
+        current_ = TextSlab::Create(kSlabCapacity);
+        space = current_->Allocate(bytes);
+    }
+    current_->Retain();
+    *slab = current_;
+    return space;
 }
 
-const uint16_t* SQLiteExternalString::data() const {
-    return data_;
+const uint16_t* RowArena::Copy(const uint16_t* data, size_t length, TextSlab** slab) {
+    void* copy = Allocate(length * sizeof(uint16_t), slab);
+    std::memcpy(copy, data, length * sizeof(uint16_t));
+    return static_cast<const uint16_t*>(copy);
 }
 
-size_t SQLiteExternalString::length() const {
-    return length_;
+void RowArena::Reset() {
+    if (current_) {
+        current_->Release();
+        current_ = nullptr;
+    }
 }
 
-void SQLiteExternalString::Dispose() {
-    // Do not delete data_ as it's owned by SQLite
-    // This is called when V8 GC no longer needs the string
+v8::Local<v8::String> NewSlabString(v8::Isolate* isolate, const uint16_t* data, size_t length, TextSlab* slab) {
+    if (length >= kMinExternalStringLength) {
+        auto extResource = new SQLiteExternalString(data, length, slab);
+        v8::Local<v8::String> extStr;
+        if (v8::String::NewExternalTwoByte(isolate, extResource).ToLocal(&extStr)) {
+            return extStr;
+        }
+        // V8 didn't take ownership; the slab stays alive through `slab`'s
+        // reference until the copy below is made
+        slab->Retain();
+        delete extResource;
+    }
+
+    v8::Local<v8::String> str = v8::String::NewFromTwoByte(isolate, data, v8::NewStringType::kNormal,
+                                                            static_cast<int>(length)).ToLocalChecked();
+    slab->Release();
+    return str;
+}
+
+v8::Local<v8::String> NewSlabOneByteString(v8::Isolate* isolate, const uint8_t* data, size_t length, TextSlab* slab) {
+    if (length >= kMinExternalStringLength) {
+        auto extResource = new SQLiteExternalOneByteString(reinterpret_cast<const char*>(data), length, slab);
+        v8::Local<v8::String> extStr;
+        if (v8::String::NewExternalOneByte(isolate, extResource).ToLocal(&extStr)) {
+            return extStr;
+        }
+        slab->Retain();
+        delete extResource;
+    }
+
+    v8::Local<v8::String> str = v8::String::NewFromOneByte(isolate, data, v8::NewStringType::kNormal,
+                                                            static_cast<int>(length)).ToLocalChecked();
+    slab->Release();
+    return str;
 }
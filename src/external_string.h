@@ -1,18 +1,94 @@
 #pragma once
 
 #include <v8.h>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 
-class SQLiteExternalString : public v8::String::ExternalStringResource {
+// Shorter strings are cheaper to copy straight onto the V8 heap than to
+// wrap in an external string resource
+constexpr size_t kMinExternalStringLength = 32;
+
+// A refcounted block of copied column text. SQLite reuses its column
+// buffers on the next step or reset, so text handed to V8 as an external
+// string lives in a slab instead; every string pins the slab it points into.
+// A slab holds both one-byte and UTF-16 text.
+class TextSlab {
 public:
-    SQLiteExternalString(const uint16_t* data, size_t length);
-    ~SQLiteExternalString() override = default;
+    // `capacity` is in bytes
+    static TextSlab* Create(size_t capacity);
+
+    void Retain();
+    void Release();
+
+    // Reserves `bytes` aligned for UTF-16 text, or returns nullptr if they
+    // don't fit.
+    void* Allocate(size_t bytes);
 
-    const uint16_t* data() const override;
-    size_t length() const override;
-    void Dispose() override;
+    // Gives back the unused end of the most recent allocation
+    void Shrink(size_t bytes);
 
 private:
-    const uint16_t* data_;
+    explicit TextSlab(size_t capacity);
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+
+    std::atomic<size_t> refs_;
+    size_t capacity_;
+    size_t used_;
+};
+
+// Hands out slab space for the text of a batch of rows. The arena holds a
+// reference to its current slab until it fills up or the batch ends.
+class RowArena {
+public:
+    RowArena() = default;
+    ~RowArena();
+
+    RowArena(const RowArena&) = delete;
+    RowArena& operator=(const RowArena&) = delete;
+
+    // Reserves `bytes` of slab space and returns it together with a
+    // reference to the slab holding it, which the caller must Release().
+    void* Allocate(size_t bytes, TextSlab** slab);
+
+    // Copies UTF-16 text into a slab, like Allocate()
+    const uint16_t* Copy(const uint16_t* data, size_t length, TextSlab** slab);
+
+    // Drops the arena's reference to the current slab. Strings already
+    // handed out keep their slabs alive on their own.
+    void Reset();
+
+private:
+    TextSlab* current_ = nullptr;
+};
+
+// External string resource over slab text, for both string widths
+template <typename Resource, typename Char>
+class SlabStringResource : public Resource {
+public:
+    // Takes over a slab reference obtained from RowArena
+    SlabStringResource(const Char* data, size_t length, TextSlab* slab) : data_(data), length_(length), slab_(slab) {}
+    ~SlabStringResource() override { slab_->Release(); }
+
+    const Char* data() const override { return data_; }
+    size_t length() const override { return length_; }
+
+    // Called when V8 GC no longer needs the string; unpins the slab
+    void Dispose() override { delete this; }
+
+private:
+    const Char* data_;
     size_t length_;
+    TextSlab* slab_;
 };
+
+using SQLiteExternalString = SlabStringResource<v8::String::ExternalStringResource, uint16_t>;
+using SQLiteExternalOneByteString = SlabStringResource<v8::String::ExternalOneByteStringResource, char>;
+
+// Creates a string for UTF-16 text held in `slab`, taking over the caller's
+// reference. Long text becomes an external string pinning the slab; short
+// text is copied and the reference dropped.
+v8::Local<v8::String> NewSlabString(v8::Isolate* isolate, const uint16_t* data, size_t length, TextSlab* slab);
+
+// Same for Latin-1 text with one byte per character
+v8::Local<v8::String> NewSlabOneByteString(v8::Isolate* isolate, const uint8_t* data, size_t length, TextSlab* slab);
@@ -0,0 +1,118 @@
+#include "row_buffer.h"
+
+using v8::BigInt;
+using v8::Isolate;
+using v8::Local;
+using v8::Null;
+using v8::Number;
+using v8::String;
+using v8::Value;
+
+RowBuffer::~RowBuffer() {
+    if (encoding_ != TextEncoding::Utf16) {
+        return;
+    }
+    // Release the text of cells that never made it to JS
+    for (auto& cell : cells_) {
+        if (cell.type == SQLITE_TEXT && cell.text.slab) {
+            cell.text.slab->Release();
+        }
+    }
+}
+
+void RowBuffer::CopyBytes(Cell* cell, const void* data, int length) {
+    cell->length = static_cast<size_t>(length);
+    cell->byte_offset = bytes_.size();
+    if (data && length > 0) {
+        const char* begin = static_cast<const char*>(data);
+        bytes_.insert(bytes_.end(), begin, begin + length);
+    }
+}
+
+void RowBuffer::Capture(sqlite3_stmt* stmt) {
+    column_count_ = sqlite3_column_count(stmt);
+
+    for (int i = 0; i < column_count_; i++) {
+        Cell cell;
+        cell.type = sqlite3_column_type(stmt, i);
+        cell.one_byte = false;
+        cell.length = 0;
+
+        switch (cell.type) {
+        case SQLITE_INTEGER:
+            cell.integer = sqlite3_column_int64(stmt, i);
+            break;
+        case SQLITE_FLOAT:
+            cell.real = sqlite3_column_double(stmt, i);
+            break;
+        case SQLITE_TEXT: {
+            if (encoding_ == TextEncoding::Utf8) {
+                CopyBytes(&cell, sqlite3_column_text(stmt, i), sqlite3_column_bytes(stmt, i));
+                break;
+            }
+            const void* text = sqlite3_column_text16(stmt, i);
+            cell.length = static_cast<size_t>(sqlite3_column_bytes16(stmt, i)) / 2;
+            cell.text.data = nullptr;
+            cell.text.slab = nullptr;
+            if (text && cell.length > 0) {
+                StagedText staged = StageUtf16(arena_, static_cast<const uint16_t*>(text), cell.length);
+                cell.text.data = staged.data;
+                cell.text.slab = staged.slab;
+                cell.one_byte = staged.one_byte;
+            }
+            break;
+        }
+        case SQLITE_BLOB:
+            CopyBytes(&cell, sqlite3_column_blob(stmt, i), sqlite3_column_bytes(stmt, i));
+            break;
+        default:
+            break;
+        }
+
+        cells_.push_back(cell);
+    }
+}
+
+Local<Value> RowBuffer::CellToJS(Isolate* isolate, size_t row, int column, StringInterner* interner,
+                                 BlobArena& blobs) {
+    Cell& cell = cells_[row * column_count_ + column];
+
+    switch (cell.type) {
+    case SQLITE_INTEGER:
+        if (cell.integer >= -9007199254740992LL && cell.integer <= 9007199254740992LL) {
+            return Number::New(isolate, static_cast<double>(cell.integer));
+        }
+        return BigInt::New(isolate, cell.integer);
+    case SQLITE_FLOAT:
+        return Number::New(isolate, cell.real);
+    case SQLITE_TEXT: {
+        Local<String> interned;
+        if (encoding_ == TextEncoding::Utf8) {
+            const char* text = bytes_.data() + cell.byte_offset;
+            if (interner && cell.length > 0 &&
+                interner->Get(isolate, text, cell.length, StringInterner::Kind::Utf8).ToLocal(&interned)) {
+                return interned;
+            }
+            return NewUtf8String(isolate, text, cell.length, arena_);
+        }
+        if (!cell.text.slab) {
+            return String::Empty(isolate);
+        }
+        StagedText staged = {cell.text.data, cell.text.slab, cell.one_byte};
+        cell.text.slab = nullptr;
+        if (interner) {
+            size_t size = staged.one_byte ? cell.length : cell.length * 2;
+            StringInterner::Kind kind = staged.one_byte ? StringInterner::Kind::Latin1 : StringInterner::Kind::Utf16;
+            if (interner->Get(isolate, staged.data, size, kind).ToLocal(&interned)) {
+                staged.slab->Release();
+                return interned;
+            }
+        }
+        return NewStagedString(isolate, staged, cell.length);
+    }
+    case SQLITE_BLOB:
+        return blobs.ToJS(isolate, bytes_.data() + cell.byte_offset, cell.length);
+    default:
+        return Null(isolate);
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <v8.h>
+#include <sqlite3.h>
+#include <cstdint>
+#include <vector>
+#include "blob_arena.h"
+#include "external_string.h"
+#include "string_interner.h"
+#include "text_encoding.h"
+
+// Staging area for result rows stepped off the main thread. Capture() only
+// touches SQLite, so it is safe on a threadpool thread; the JS values are
+// created later on the main thread in one pass with CellToJS().
+//
+// Text is captured in the connection's encoding: UTF-16 into slabs that
+// back external strings, narrowed to one byte per character when it fits
+// Latin-1, and UTF-8 next to the blobs.
+class RowBuffer {
+public:
+    explicit RowBuffer(TextEncoding encoding) : encoding_(encoding) {}
+    ~RowBuffer();
+
+    RowBuffer(const RowBuffer&) = delete;
+    RowBuffer& operator=(const RowBuffer&) = delete;
+
+    // Copies the statement's current row into the buffer
+    void Capture(sqlite3_stmt* stmt);
+
+    size_t RowCount() const { return column_count_ == 0 ? 0 : cells_.size() / column_count_; }
+    int ColumnCount() const { return column_count_; }
+
+    // Creates the JS value of a captured cell. UTF-16 text is handed over to
+    // V8 from the slab it was staged in, so each cell can be converted once.
+    // Long UTF-8 text may be decoded into the buffer's arena. Text goes
+    // through `interner` when there is one, BLOBs through `blobs`.
+    v8::Local<v8::Value> CellToJS(v8::Isolate* isolate, size_t row, int column, StringInterner* interner,
+                                  BlobArena& blobs);
+
+private:
+    struct Cell {
+        int type;
+        bool one_byte;
+        union {
+            int64_t integer;
+            double real;
+            struct {
+                const void* data;
+                TextSlab* slab;
+            } text;
+            // Blobs and UTF-8 text
+            size_t byte_offset;
+        };
+        size_t length;
+    };
+
+    TextEncoding encoding_;
+    int column_count_ = 0;
+    std::vector<Cell> cells_;
+    std::vector<char> bytes_;
+    RowArena arena_;
+
+    void CopyBytes(Cell* cell, const void* data, int length);
+};
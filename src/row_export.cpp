@@ -0,0 +1,275 @@
+#include "row_export.h"
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+// Output is handed to write(2) once this much has been formatted
+static constexpr size_t kFlushBytes = 1 << 20;
+
+bool ParseExportFormat(const char* name, ExportFormat* format) {
+    if (strcmp(name, "csv") == 0) {
+        *format = ExportFormat::Csv;
+        return true;
+    }
+    if (strcmp(name, "ndjson") == 0) {
+        *format = ExportFormat::Ndjson;
+        return true;
+    }
+    return false;
+}
+
+// Bytes that force a CSV field to be quoted, and bytes that a JSON string
+// must escape
+static const struct EscapeTables {
+    bool csv[256];
+    bool json[256];
+
+    EscapeTables() : csv(), json() {
+        csv[static_cast<uint8_t>(',')] = csv[static_cast<uint8_t>('"')] = true;
+        csv[static_cast<uint8_t>('\r')] = csv[static_cast<uint8_t>('\n')] = true;
+        for (int c = 0; c < 0x20; c++) {
+            json[c] = true;
+        }
+        json[static_cast<uint8_t>('"')] = json[static_cast<uint8_t>('\\')] = true;
+    }
+} kEscape;
+
+class ExportWriter {
+public:
+    ExportWriter(int fd, std::string* error) : fd_(fd), error_(error) {
+        out_.reserve(kFlushBytes + 4096);
+    }
+
+    std::string& Out() { return out_; }
+
+    bool MaybeFlush() {
+        return out_.size() < kFlushBytes || Flush();
+    }
+
+    bool Flush() {
+        const char* data = out_.data();
+        size_t length = out_.size();
+        while (length > 0) {
+            ssize_t written = write(fd_, data, length);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                *error_ = std::string("Cannot write export: ") + strerror(errno);
+                return false;
+            }
+            data += written;
+            length -= static_cast<size_t>(written);
+        }
+        out_.clear();
+        return true;
+    }
+
+private:
+    int fd_;
+    std::string* error_;
+    std::string out_;
+};
+
+static void AppendInteger(std::string& out, sqlite3_int64 value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+// Shortest round-tripping form, which is also what JavaScript prints for
+// finite numbers
+static void AppendReal(std::string& out, double value, bool json) {
+    if (!std::isfinite(value)) {
+        // SQLite turns NaN into NULL, so only infinities get here
+        out.append(json ? "null" : value > 0 ? "Infinity" : "-Infinity");
+        return;
+    }
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+static void AppendHex(std::string& out, const uint8_t* data, size_t length) {
+    static const char kHexDigits[] = "0123456789abcdef";
+    size_t start = out.size();
+    out.resize(start + 2 * length);
+    char* hex = out.data() + start;
+    for (size_t i = 0; i < length; i++) {
+        hex[2 * i] = kHexDigits[data[i] >> 4];
+        hex[2 * i + 1] = kHexDigits[data[i] & 0xF];
+    }
+}
+
+// RFC 4180: fields holding a separator, quote or line break are quoted,
+// with quotes doubled. Empty text is quoted too, since an empty field is
+// how NULL is written.
+static void AppendCsvText(std::string& out, const char* data, size_t length) {
+    size_t i = 0;
+    while (i < length && !kEscape.csv[static_cast<uint8_t>(data[i])]) {
+        i++;
+    }
+    if (i == length && length > 0) {
+        out.append(data, length);
+        return;
+    }
+
+    out.push_back('"');
+    size_t run = 0;
+    for (i = 0; i < length; i++) {
+        if (data[i] == '"') {
+            out.append(data + run, i + 1 - run);
+            out.push_back('"');
+            run = i + 1;
+        }
+    }
+    out.append(data + run, length - run);
+    out.push_back('"');
+}
+
+// Copies runs of plain bytes at once; text is written as UTF-8 as stored
+static void AppendJsonString(std::string& out, const char* data, size_t length) {
+    static const char kHexDigits[] = "0123456789abcdef";
+    out.push_back('"');
+    size_t run = 0;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t c = static_cast<uint8_t>(data[i]);
+        if (!kEscape.json[c]) {
+            continue;
+        }
+        out.append(data + run, i - run);
+        run = i + 1;
+        switch (c) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default: {
+            const char escape[] = {'\\', 'u', '0', '0', kHexDigits[c >> 4], kHexDigits[c & 0xF]};
+            out.append(escape, sizeof(escape));
+            break;
+        }
+        }
+    }
+    out.append(data + run, length - run);
+    out.push_back('"');
+}
+
+static void AppendValue(std::string& out, sqlite3_stmt* stmt, int column, bool json) {
+    switch (sqlite3_column_type(stmt, column)) {
+    case SQLITE_INTEGER:
+        AppendInteger(out, sqlite3_column_int64(stmt, column));
+        break;
+    case SQLITE_FLOAT:
+        AppendReal(out, sqlite3_column_double(stmt, column), json);
+        break;
+    case SQLITE_TEXT: {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+        size_t length = static_cast<size_t>(sqlite3_column_bytes(stmt, column));
+        if (json) {
+            AppendJsonString(out, text, length);
+        } else {
+            AppendCsvText(out, text, length);
+        }
+        break;
+    }
+    case SQLITE_BLOB: {
+        // BLOBs are written as hex, quoted in JSON
+        const uint8_t* data = static_cast<const uint8_t*>(sqlite3_column_blob(stmt, column));
+        size_t length = static_cast<size_t>(sqlite3_column_bytes(stmt, column));
+        if (json) {
+            out.push_back('"');
+        }
+        AppendHex(out, data, length);
+        if (json) {
+            out.push_back('"');
+        }
+        break;
+    }
+    default:
+        // NULL is an empty CSV field. In a one-column result that makes
+        // an empty line, which CSV readers skip; see exportTo() in index.d.ts
+        if (json) {
+            out.append("null");
+        }
+        break;
+    }
+}
+
+static bool WriteRows(sqlite3_stmt* stmt, int fd, const ExportOptions& options, uint64_t* rows, std::string* error) {
+    int colCount = sqlite3_column_count(stmt);
+    bool json = options.format == ExportFormat::Ndjson;
+    ExportWriter writer(fd, error);
+    std::string& out = writer.Out();
+
+    // In NDJSON, the key of each column with the punctuation before it,
+    // built once
+    std::vector<std::string> keys;
+    for (int i = 0; i < colCount; i++) {
+        const char* name = sqlite3_column_name(stmt, i);
+        if (json) {
+            keys.emplace_back(i == 0 ? "{" : ",");
+            AppendJsonString(keys.back(), name, strlen(name));
+            keys.back().push_back(':');
+        } else if (options.header) {
+            AppendCsvText(out, name, strlen(name));
+            out.push_back(i + 1 < colCount ? ',' : '\n');
+        }
+    }
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        for (int i = 0; i < colCount; i++) {
+            if (json) {
+                out.append(keys[i]);
+            } else if (i > 0) {
+                out.push_back(',');
+            }
+            AppendValue(out, stmt, i, json);
+        }
+        if (json) {
+            out.append(colCount > 0 ? "}\n" : "{}\n");
+        } else {
+            out.push_back('\n');
+        }
+        (*rows)++;
+        if (!writer.MaybeFlush()) {
+            return false;
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        *error = sqlite3_errmsg(sqlite3_db_handle(stmt));
+        return false;
+    }
+    return writer.Flush();
+}
+
+bool ExportRows(sqlite3_stmt* stmt, const ExportTarget& target, const ExportOptions& options, uint64_t* rows,
+                std::string* error) {
+    *rows = 0;
+    int fd = target.fd;
+    if (!target.path.empty()) {
+        fd = open(target.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            *error = "Cannot open " + target.path + ": " + strerror(errno);
+            sqlite3_reset(stmt);
+            return false;
+        }
+    }
+
+    bool ok = WriteRows(stmt, fd, options, rows, error);
+    sqlite3_reset(stmt);
+
+    if (!target.path.empty() && close(fd) != 0 && ok) {
+        *error = "Cannot write export: " + std::string(strerror(errno));
+        ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <cstdint>
+#include <string>
+
+enum class ExportFormat {
+    Csv,
+    Ndjson
+};
+
+// Parses the name of a format as passed to stmt.exportTo()
+bool ParseExportFormat(const char* name, ExportFormat* format);
+
+// Where exportTo() writes: the file at `path`, created or truncated, or
+// else the already open descriptor `fd`, which is left open
+struct ExportTarget {
+    int fd = -1;
+    std::string path;
+};
+
+struct ExportOptions {
+    ExportFormat format = ExportFormat::Csv;
+    // Whether CSV output starts with a line of column names
+    bool header = true;
+};
+
+// Steps the statement to the end of its result set, formats each row into
+// a reusable buffer and writes it out in large write(2) calls, then resets
+// the statement. Touches no V8 state, so it can run on the threadpool.
+// Returns false and sets `error` on failure.
+bool ExportRows(sqlite3_stmt* stmt, const ExportTarget& target, const ExportOptions& options, uint64_t* rows,
+                std::string* error);
@@ -0,0 +1,448 @@
+#include "simd_text.h"
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__)
+#define MO_BETTA_SIMD_X86
+#include <immintrin.h>
+#define MO_BETTA_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__aarch64__)
+#define MO_BETTA_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Scalar kernels, also used for the tails the vector kernels leave over
+
+static bool IsAsciiScalar(const char* data, size_t length) {
+    constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        if (word & kHighBits) {
+            return false;
+        }
+    }
+    for (; i < length; i++) {
+        if (static_cast<unsigned char>(data[i]) & 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool IsLatin1Scalar(const uint16_t* data, size_t length) {
+    uint16_t bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        bits |= data[i];
+    }
+    return bits < 0x100;
+}
+
+static void NarrowLatin1Scalar(const uint16_t* data, size_t length, uint8_t* out) {
+    for (size_t i = 0; i < length; i++) {
+        out[i] = static_cast<uint8_t>(data[i]);
+    }
+}
+
+static size_t FindCsvSpecialScalar(const char* data, size_t length, char delimiter) {
+    for (size_t i = 0; i < length; i++) {
+        char c = data[i];
+        if (c == delimiter || c == '"' || c == '\n' || c == '\r') {
+            return i;
+        }
+    }
+    return length;
+}
+
+// Decodes the sequence starting at the non-ASCII byte `s[0]` following the
+// WHATWG rules: a malformed sequence becomes one U+FFFD and only its valid
+// prefix is consumed. Returns the number of bytes consumed.
+static size_t DecodeSequence(const uint8_t* s, size_t remaining, uint16_t* out, size_t* written) {
+    uint8_t lead = s[0];
+    uint8_t lower = 0x80;
+    uint8_t upper = 0xBF;
+    size_t needed;
+    uint32_t code_point;
+
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        needed = 1;
+        code_point = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        needed = 2;
+        code_point = lead & 0x0F;
+        if (lead == 0xE0) {
+            lower = 0xA0;
+        } else if (lead == 0xED) {
+            upper = 0x9F;
+        }
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        needed = 3;
+        code_point = lead & 0x07;
+        if (lead == 0xF0) {
+            lower = 0x90;
+        } else if (lead == 0xF4) {
+            upper = 0x8F;
+        }
+    } else {
+        out[0] = 0xFFFD;
+        *written = 1;
+        return 1;
+    }
+
+    size_t i = 1;
+    for (; i <= needed; i++) {
+        if (i >= remaining || s[i] < lower || s[i] > upper) {
+            out[0] = 0xFFFD;
+            *written = 1;
+            return i;
+        }
+        code_point = (code_point << 6) | (s[i] & 0x3F);
+        lower = 0x80;
+        upper = 0xBF;
+    }
+
+    if (code_point >= 0x10000) {
+        code_point -= 0x10000;
+        out[0] = static_cast<uint16_t>(0xD800 + (code_point >> 10));
+        out[1] = static_cast<uint16_t>(0xDC00 + (code_point & 0x3FF));
+        *written = 2;
+    } else {
+        out[0] = static_cast<uint16_t>(code_point);
+        *written = 1;
+    }
+    return i;
+}
+
+// Decodes one character, ASCII or not, at `data[*in]`
+static void DecodeNext(const uint8_t* data, size_t length, size_t* in, uint16_t* out, size_t* written) {
+    if (data[*in] < 0x80) {
+        out[(*written)++] = data[(*in)++];
+        return;
+    }
+    size_t units;
+    *in += DecodeSequence(data + *in, length - *in, out + *written, &units);
+    *written += units;
+}
+
+#if !defined(MO_BETTA_SIMD_X86) && !defined(MO_BETTA_SIMD_NEON)
+static size_t Utf8ToUtf16Scalar(const char* data, size_t length, uint16_t* out) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    size_t in = 0;
+    size_t written = 0;
+    while (in < length) {
+        DecodeNext(bytes, length, &in, out, &written);
+    }
+    return written;
+}
+#endif
+
+#ifdef MO_BETTA_SIMD_X86
+
+static bool IsAsciiSse2(const char* data, size_t length) {
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 48));
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)))) {
+            return false;
+        }
+    }
+    for (; i + 16 <= length; i += 16) {
+        if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)))) {
+            return false;
+        }
+    }
+    return IsAsciiScalar(data + i, length - i);
+}
+
+static bool IsLatin1Sse2(const uint16_t* data, size_t length) {
+    const __m128i high = _mm_set1_epi16(static_cast<short>(0xFF00));
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 8));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 24));
+        __m128i bits = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), high);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(bits, _mm_setzero_si128())) != 0xFFFF) {
+            return false;
+        }
+    }
+    for (; i + 8 <= length; i += 8) {
+        __m128i bits = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), high);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(bits, _mm_setzero_si128())) != 0xFFFF) {
+            return false;
+        }
+    }
+    return IsLatin1Scalar(data + i, length - i);
+}
+
+static void NarrowLatin1Sse2(const uint16_t* data, size_t length, uint8_t* out) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        // Saturation never kicks in since every unit is below 0x100
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(a, b));
+    }
+    NarrowLatin1Scalar(data + i, length - i, out + i);
+}
+
+static size_t Utf8ToUtf16Sse2(const char* data, size_t length, uint16_t* out) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    const __m128i zero = _mm_setzero_si128();
+    size_t in = 0;
+    size_t written = 0;
+    while (in < length) {
+        if (in + 16 <= length) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + in));
+            if (!_mm_movemask_epi8(block)) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + written), _mm_unpacklo_epi8(block, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + written + 8), _mm_unpackhi_epi8(block, zero));
+                in += 16;
+                written += 16;
+                continue;
+            }
+        }
+        DecodeNext(bytes, length, &in, out, &written);
+    }
+    return written;
+}
+
+static size_t FindCsvSpecialSse2(const char* data, size_t length, char delimiter) {
+    const __m128i delimiters = _mm_set1_epi8(delimiter);
+    const __m128i quotes = _mm_set1_epi8('"');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    const __m128i returns = _mm_set1_epi8('\r');
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, delimiters), _mm_cmpeq_epi8(chunk, quotes)),
+                                       _mm_or_si128(_mm_cmpeq_epi8(chunk, newlines), _mm_cmpeq_epi8(chunk, returns)));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+        if (mask) {
+            return i + std::countr_zero(mask);
+        }
+    }
+    return i + FindCsvSpecialScalar(data + i, length - i, delimiter);
+}
+
+MO_BETTA_TARGET_AVX2 static bool IsAsciiAvx2(const char* data, size_t length) {
+    size_t i = 0;
+    for (; i + 128 <= length; i += 128) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 64));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 96));
+        if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)))) {
+            return false;
+        }
+    }
+    for (; i + 32 <= length; i += 32) {
+        if (_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)))) {
+            return false;
+        }
+    }
+    return IsAsciiScalar(data + i, length - i);
+}
+
+MO_BETTA_TARGET_AVX2 static bool IsLatin1Avx2(const uint16_t* data, size_t length) {
+    const __m256i high = _mm256_set1_epi16(static_cast<short>(0xFF00));
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 16));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 48));
+        if (!_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)), high)) {
+            return false;
+        }
+    }
+    for (; i + 16 <= length; i += 16) {
+        if (!_mm256_testz_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), high)) {
+            return false;
+        }
+    }
+    return IsLatin1Scalar(data + i, length - i);
+}
+
+MO_BETTA_TARGET_AVX2 static void NarrowLatin1Avx2(const uint16_t* data, size_t length, uint8_t* out) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 16));
+        // packus works within 128-bit lanes; put the quarters back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    NarrowLatin1Sse2(data + i, length - i, out + i);
+}
+
+MO_BETTA_TARGET_AVX2 static size_t FindCsvSpecialAvx2(const char* data, size_t length, char delimiter) {
+    const __m256i delimiters = _mm256_set1_epi8(delimiter);
+    const __m256i quotes = _mm256_set1_epi8('"');
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    const __m256i returns = _mm256_set1_epi8('\r');
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i special =
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, delimiters), _mm256_cmpeq_epi8(chunk, quotes)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, newlines), _mm256_cmpeq_epi8(chunk, returns)));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+        if (mask) {
+            return i + std::countr_zero(mask);
+        }
+    }
+    return i + FindCsvSpecialScalar(data + i, length - i, delimiter);
+}
+
+// Also false when the OS does not save the YMM registers
+static bool CpuHasAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif  // MO_BETTA_SIMD_X86
+
+#ifdef MO_BETTA_SIMD_NEON
+
+static bool IsAsciiNeon(const char* data, size_t length) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        uint8x16_t a = vld1q_u8(bytes + i);
+        uint8x16_t b = vld1q_u8(bytes + i + 16);
+        uint8x16_t c = vld1q_u8(bytes + i + 32);
+        uint8x16_t d = vld1q_u8(bytes + i + 48);
+        if (vmaxvq_u8(vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d))) >= 0x80) {
+            return false;
+        }
+    }
+    for (; i + 16 <= length; i += 16) {
+        if (vmaxvq_u8(vld1q_u8(bytes + i)) >= 0x80) {
+            return false;
+        }
+    }
+    return IsAsciiScalar(data + i, length - i);
+}
+
+static bool IsLatin1Neon(const uint16_t* data, size_t length) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        uint16x8_t a = vld1q_u16(data + i);
+        uint16x8_t b = vld1q_u16(data + i + 8);
+        uint16x8_t c = vld1q_u16(data + i + 16);
+        uint16x8_t d = vld1q_u16(data + i + 24);
+        if (vmaxvq_u16(vorrq_u16(vorrq_u16(a, b), vorrq_u16(c, d))) >= 0x100) {
+            return false;
+        }
+    }
+    for (; i + 8 <= length; i += 8) {
+        if (vmaxvq_u16(vld1q_u16(data + i)) >= 0x100) {
+            return false;
+        }
+    }
+    return IsLatin1Scalar(data + i, length - i);
+}
+
+static void NarrowLatin1Neon(const uint16_t* data, size_t length, uint8_t* out) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t packed = vcombine_u8(vmovn_u16(vld1q_u16(data + i)), vmovn_u16(vld1q_u16(data + i + 8)));
+        vst1q_u8(out + i, packed);
+    }
+    NarrowLatin1Scalar(data + i, length - i, out + i);
+}
+
+static size_t Utf8ToUtf16Neon(const char* data, size_t length, uint16_t* out) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    size_t in = 0;
+    size_t written = 0;
+    while (in < length) {
+        if (in + 16 <= length) {
+            uint8x16_t block = vld1q_u8(bytes + in);
+            if (vmaxvq_u8(block) < 0x80) {
+                vst1q_u16(out + written, vmovl_u8(vget_low_u8(block)));
+                vst1q_u16(out + written + 8, vmovl_u8(vget_high_u8(block)));
+                in += 16;
+                written += 16;
+                continue;
+            }
+        }
+        DecodeNext(bytes, length, &in, out, &written);
+    }
+    return written;
+}
+
+static size_t FindCsvSpecialNeon(const char* data, size_t length, char delimiter) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    const uint8x16_t delimiters = vdupq_n_u8(static_cast<uint8_t>(delimiter));
+    const uint8x16_t quotes = vdupq_n_u8('"');
+    const uint8x16_t newlines = vdupq_n_u8('\n');
+    const uint8x16_t returns = vdupq_n_u8('\r');
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t chunk = vld1q_u8(bytes + i);
+        uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(chunk, delimiters), vceqq_u8(chunk, quotes)),
+                                      vorrq_u8(vceqq_u8(chunk, newlines), vceqq_u8(chunk, returns)));
+        // Narrows the comparison to four bits per byte
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(special), 4)), 0);
+        if (mask) {
+            return i + std::countr_zero(mask) / 4;
+        }
+    }
+    return i + FindCsvSpecialScalar(data + i, length - i, delimiter);
+}
+
+#endif  // MO_BETTA_SIMD_NEON
+
+struct Kernels {
+    bool (*is_ascii)(const char*, size_t);
+    bool (*is_latin1)(const uint16_t*, size_t);
+    void (*narrow_latin1)(const uint16_t*, size_t, uint8_t*);
+    size_t (*utf8_to_utf16)(const char*, size_t, uint16_t*);
+    size_t (*find_csv_special)(const char*, size_t, char);
+};
+
+static Kernels SelectKernels() {
+#if defined(MO_BETTA_SIMD_X86)
+    // SSE2 is part of x86-64. Decoding UTF-8 is bound by its scalar part,
+    // so it has no AVX2 version.
+    if (CpuHasAvx2()) {
+        return {IsAsciiAvx2, IsLatin1Avx2, NarrowLatin1Avx2, Utf8ToUtf16Sse2, FindCsvSpecialAvx2};
+    }
+    return {IsAsciiSse2, IsLatin1Sse2, NarrowLatin1Sse2, Utf8ToUtf16Sse2, FindCsvSpecialSse2};
+#elif defined(MO_BETTA_SIMD_NEON)
+    // NEON is part of AArch64
+    return {IsAsciiNeon, IsLatin1Neon, NarrowLatin1Neon, Utf8ToUtf16Neon, FindCsvSpecialNeon};
+#else
+    return {IsAsciiScalar, IsLatin1Scalar, NarrowLatin1Scalar, Utf8ToUtf16Scalar, FindCsvSpecialScalar};
+#endif
+}
+
+static const Kernels kKernels = SelectKernels();
+
+bool IsAscii(const char* data, size_t length) {
+    return kKernels.is_ascii(data, length);
+}
+
+bool IsLatin1(const uint16_t* data, size_t length) {
+    return kKernels.is_latin1(data, length);
+}
+
+void NarrowLatin1(const uint16_t* data, size_t length, uint8_t* out) {
+    kKernels.narrow_latin1(data, length, out);
+}
+
+size_t Utf8ToUtf16(const char* data, size_t length, uint16_t* out) {
+    return kKernels.utf8_to_utf16(data, length, out);
+}
+
+size_t FindCsvSpecial(const char* data, size_t length, char delimiter) {
+    return kKernels.find_csv_special(data, length, delimiter);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorized scans and conversions of column text. Each kernel has SSE2,
+// AVX2 and NEON versions next to a scalar one; on x86-64 AVX2 is used when
+// the CPU supports it, which is checked once when the addon loads.
+
+// True if every byte is below 0x80
+bool IsAscii(const char* data, size_t length);
+
+// True if every UTF-16 code unit is below 0x100, so that the text fits a
+// one-byte string
+bool IsLatin1(const uint16_t* data, size_t length);
+
+// Copies code units that IsLatin1() accepted into one byte each
+void NarrowLatin1(const uint16_t* data, size_t length, uint8_t* out);
+
+// Decodes UTF-8 into UTF-16 and returns the number of code units written,
+// at most `length`. Invalid sequences become U+FFFD, as with V8's decoder.
+size_t Utf8ToUtf16(const char* data, size_t length, uint16_t* out);
+
+// Index of the first byte that is `delimiter`, a double quote, CR or LF,
+// or `length` if there is none; the scan behind CSV parsing
+size_t FindCsvSpecial(const char* data, size_t length, char delimiter);
@@ -1,30 +1,48 @@
 #include "statement.h"
+#include "addon_data.h"
+#include "arrow_ipc.h"
+#include "async_work.h"
 #include "database.h"
-#include "external_string.h"
 #include <node_buffer.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string_view>
 
+using v8::Array;
+using v8::ArrayBuffer;
 using v8::BigInt;
+using v8::BigInt64Array;
 using v8::Boolean;
 using v8::Context;
+using v8::DictionaryTemplate;
 using v8::Exception;
-using v8::External;
 using v8::Function;
 using v8::FunctionCallbackInfo;
 using v8::FunctionTemplate;
+using v8::Global;
+using v8::HandleScope;
+using v8::Int32;
+using v8::Integer;
 using v8::Isolate;
 using v8::Local;
+using v8::MaybeLocal;
+using v8::MemorySpan;
 using v8::NewStringType;
 using v8::Null;
 using v8::Number;
 using v8::Object;
-using v8::Persistent;
 using v8::String;
-using v8::Symbol;
+using v8::Undefined;
 using v8::Value;
 
-Persistent<Function> Statement::constructor;
+static const char *const kNoSuchColumn = "Column index out of range, or no current row";
+static const char *const kNoSuchParameter = "Parameter index out of range";
 
-Statement::Statement(sqlite3_stmt *stmt, Database *db) : stmt_(stmt), db_(db), column_names_initialized_(false)
+// Rows per Arrow record batch unless toArrow() is told otherwise
+static constexpr size_t kDefaultArrowBatchRows = 65536;
+
+Statement::Statement(sqlite3_stmt *stmt, Database *db) : stmt_(stmt), db_(db), addon_data_(db->GetAddonData()), column_names_initialized_(false), raw_(false), binder_(db->GetTextEncoding()), intern_max_distinct_(0)
 {
 }
 
@@ -36,6 +54,7 @@ Statement::~Statement()
         name.Reset();
     }
     cached_column_names_.clear();
+    row_template_.Reset();
 
     if (stmt_)
     {
@@ -44,40 +63,77 @@ Statement::~Statement()
     }
 }
 
-void Statement::Init(Local<Object> exports)
+void Statement::Init(Local<Object> exports, AddonData *addon_data)
 {
     Isolate *isolate = exports->GetIsolate();
     Local<Context> context = isolate->GetCurrentContext();
 
     Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, New);
     tpl->SetClassName(String::NewFromUtf8(isolate, "Statement", NewStringType::kNormal).ToLocalChecked());
-    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    // The second field holds the database object to keep it alive
+    tpl->InstanceTemplate()->SetInternalFieldCount(2);
+
+#ifdef MO_BETTA_FAST_API
+    static const v8::CFunction fastStep = v8::CFunction::Make(FastStep);
+    static const v8::CFunction fastReset = v8::CFunction::Make(FastReset);
+    static const v8::CFunction fastGetInt = v8::CFunction::Make(FastGetInt);
+    static const v8::CFunction fastGetDouble = v8::CFunction::Make(FastGetDouble);
+    static const v8::CFunction fastBindInt = v8::CFunction::Make(FastBindInt);
+    static const v8::CFunction fastBindDouble = v8::CFunction::Make(FastBindDouble);
 
+    SetFastMethod(isolate, tpl, "step", Step, &fastStep);
+    SetFastMethod(isolate, tpl, "reset", Reset, &fastReset);
+    SetFastMethod(isolate, tpl, "getInt", GetInt, &fastGetInt);
+    SetFastMethod(isolate, tpl, "getDouble", GetDouble, &fastGetDouble);
+    SetFastMethod(isolate, tpl, "bindInt", BindInt, &fastBindInt);
+    SetFastMethod(isolate, tpl, "bindDouble", BindDouble, &fastBindDouble);
+#else
     NODE_SET_PROTOTYPE_METHOD(tpl, "step", Step);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "reset", Reset);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "getInt", GetInt);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "getDouble", GetDouble);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "bindInt", BindInt);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "bindDouble", BindDouble);
+#endif
     NODE_SET_PROTOTYPE_METHOD(tpl, "get", Get);
     NODE_SET_PROTOTYPE_METHOD(tpl, "finalize", Finalize);
-    NODE_SET_PROTOTYPE_METHOD(tpl, "iterate", Iterate);
     NODE_SET_PROTOTYPE_METHOD(tpl, "next", Next);
-    NODE_SET_PROTOTYPE_METHOD(tpl, "reset", Reset);
-
-    // Set up Symbol.iterator
-    tpl->PrototypeTemplate()->Set(Symbol::GetIterator(isolate), FunctionTemplate::New(isolate, Iterator));
+    NODE_SET_PROTOTYPE_METHOD(tpl, "nextBatch", NextBatch);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "bind", Bind);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "all", All);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "run", Run);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "runMany", RunMany);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "runColumns", RunColumns);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "raw", Raw);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "intern", Intern);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "blobMode", SetBlobMode);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "columns", Columns);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "columnIndex", ColumnIndex);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "fetchColumns", FetchColumns);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "toArrow", ToArrow);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "exportTo", ExportTo);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "allAsync", AllAsync);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "runAsync", RunAsync);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "exportToAsync", ExportToAsync);
 
     Local<Function> constructor_local = tpl->GetFunction(context).ToLocalChecked();
-    constructor.Reset(isolate, constructor_local);
+    addon_data->statement_constructor.Reset(isolate, constructor_local);
     exports->Set(context, String::NewFromUtf8(isolate, "Statement", NewStringType::kNormal).ToLocalChecked(),
                  constructor_local)
         .FromJust();
 }
 
-Local<Object> Statement::NewInstance(Isolate *isolate, sqlite3_stmt *stmt, Database *db)
+Local<Object> Statement::NewInstance(Isolate *isolate, sqlite3_stmt *stmt, Database *db, Local<Object> database, Local<String> sql)
 {
     Local<Context> context = isolate->GetCurrentContext();
-    Local<Function> cons = Local<Function>::New(isolate, constructor);
+    Local<Function> cons = db->GetAddonData()->statement_constructor.Get(isolate);
     Local<Object> instance = cons->NewInstance(context, 0, nullptr).ToLocalChecked();
 
     Statement *statement = new Statement(stmt, db);
+    statement->sql_.Reset(isolate, sql);
     statement->Wrap(instance);
+    instance->SetInternalField(1, database);
+    db->RegisterStatement(statement);
 
     return instance;
 }
@@ -101,13 +157,21 @@ void Statement::Step(const FunctionCallbackInfo<Value> &args)
 {
     Isolate *isolate = args.GetIsolate();
 
-    Statement *stmt = Unwrap(args.Holder());
-    if (!stmt || !stmt->IsValid())
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+#ifdef MO_BETTA_FAST_API_FALLBACK
+    if (stmt->fast_step_failed_)
     {
+        stmt->fast_step_failed_ = false;
         isolate->ThrowException(Exception::Error(
-            String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+            String::NewFromUtf8(isolate, sqlite3_errmsg(sqlite3_db_handle(stmt->stmt_)), NewStringType::kNormal).ToLocalChecked()));
         return;
     }
+#endif
 
     int rc = sqlite3_step(stmt->stmt_);
 
@@ -126,15 +190,307 @@ void Statement::Step(const FunctionCallbackInfo<Value> &args)
     }
 }
 
-void Statement::Get(const FunctionCallbackInfo<Value> &args)
+// Typed accessors for loops over numeric columns, which skip the type
+// dispatch of get(). Columns are 0-based, parameters 1-based as in SQLite.
+
+bool Statement::HasColumn(int index) const
+{
+    return index >= 0 && index < sqlite3_data_count(stmt_);
+}
+
+void Statement::GetInt(const FunctionCallbackInfo<Value> &args)
 {
     Isolate *isolate = args.GetIsolate();
 
-    Statement *stmt = Unwrap(args.Holder());
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    int index = args[0]->IsInt32() ? args[0].As<Int32>()->Value() : -1;
+    if (!stmt->HasColumn(index))
+    {
+        isolate->ThrowException(Exception::RangeError(
+            String::NewFromUtf8(isolate, kNoSuchColumn, NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    // sqlite3_column_int() would silently keep the low 32 bits
+    sqlite3_int64 value = sqlite3_column_int64(stmt->stmt_, index);
+    if (value < INT32_MIN || value > INT32_MAX)
+    {
+        isolate->ThrowException(Exception::RangeError(
+            String::NewFromUtf8(isolate, "Column value does not fit in a 32-bit integer", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    args.GetReturnValue().Set(static_cast<int32_t>(value));
+}
+
+void Statement::GetDouble(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    int index = args[0]->IsInt32() ? args[0].As<Int32>()->Value() : -1;
+    if (!stmt->HasColumn(index))
+    {
+        isolate->ThrowException(Exception::RangeError(
+            String::NewFromUtf8(isolate, kNoSuchColumn, NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    args.GetReturnValue().Set(sqlite3_column_double(stmt->stmt_, index));
+}
+
+void Statement::BindInt(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    if (!args[0]->IsInt32() || !args[1]->IsInt32())
+    {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "bindInt() takes a parameter index and a 32-bit integer", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    if (sqlite3_bind_int(stmt->stmt_, args[0].As<Int32>()->Value(), args[1].As<Int32>()->Value()) != SQLITE_OK)
+    {
+        isolate->ThrowException(Exception::RangeError(
+            String::NewFromUtf8(isolate, kNoSuchParameter, NewStringType::kNormal).ToLocalChecked()));
+    }
+}
+
+void Statement::BindDouble(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    if (!args[0]->IsInt32() || !args[1]->IsNumber())
+    {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "bindDouble() takes a parameter index and a number", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    if (sqlite3_bind_double(stmt->stmt_, args[0].As<Int32>()->Value(), args[1].As<Number>()->Value()) != SQLITE_OK)
+    {
+        isolate->ThrowException(Exception::RangeError(
+            String::NewFromUtf8(isolate, kNoSuchParameter, NewStringType::kNormal).ToLocalChecked()));
+    }
+}
+
+#ifdef MO_BETTA_FAST_API
+// Fast calls return unboxed values and run without a HandleScope. They
+// take numbers as doubles so that the values the regular callbacks reject
+// (fractions, -0) can be told apart, and fail before changing anything, so
+// that the regular callback can run in their place.
+
+static void ThrowFastError(v8::FastApiCallbackOptions &options, const char *message, bool range = false)
+{
+#ifdef MO_BETTA_FAST_API_FALLBACK
+    // The regular callback comes to the same error
+    static_cast<void>(message);
+    static_cast<void>(range);
+    options.fallback = true;
+#else
+    HandleScope scope(options.isolate);
+    Local<String> text = String::NewFromUtf8(options.isolate, message, NewStringType::kNormal).ToLocalChecked();
+    options.isolate->ThrowException(range ? Exception::RangeError(text) : Exception::Error(text));
+#endif
+}
+
+// Whether `value` is a number the regular callbacks accept as an Int32
+static bool ExactInt32(double value, int32_t *out)
+{
+    if (!(value >= INT32_MIN && value <= INT32_MAX) || (value == 0 && std::signbit(value)))
+    {
+        return false;
+    }
+    *out = static_cast<int32_t>(value);
+    return *out == value;
+}
+
+Statement *Statement::FastUnwrapUsable(Local<Object> receiver, v8::FastApiCallbackOptions &options)
+{
+    Statement *stmt = Unwrap(receiver);
+    const char *error = stmt ? stmt->UsableError() : "Statement is finalized";
+    if (error)
+    {
+        ThrowFastError(options, error);
+        return nullptr;
+    }
+    return stmt;
+}
+
+bool Statement::FastStep(Local<Object> receiver, v8::FastApiCallbackOptions &options)
+{
+    Statement *stmt = FastUnwrapUsable(receiver, options);
+    if (!stmt)
+    {
+        return false;
+    }
+
+    int rc = sqlite3_step(stmt->stmt_);
+    if (rc == SQLITE_ROW)
+    {
+        return true;
+    }
+    if (rc != SQLITE_DONE)
+    {
+#ifdef MO_BETTA_FAST_API_FALLBACK
+        stmt->fast_step_failed_ = true;
+#endif
+        ThrowFastError(options, sqlite3_errmsg(sqlite3_db_handle(stmt->stmt_)));
+    }
+    return false;
+}
+
+void Statement::FastReset(Local<Object> receiver, v8::FastApiCallbackOptions &options)
+{
+    Statement *stmt = Unwrap(receiver);
     if (!stmt || !stmt->IsValid())
     {
-        isolate->ThrowException(Exception::Error(
-            String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+    if (stmt->db_->IsBusy())
+    {
+        ThrowFastError(options, "Database is busy with an asynchronous operation");
+        return;
+    }
+    sqlite3_reset(stmt->stmt_);
+    stmt->arena_.Reset();
+    stmt->blob_arena_.Reset();
+}
+
+int32_t Statement::FastGetInt(Local<Object> receiver, double index, v8::FastApiCallbackOptions &options)
+{
+    Statement *stmt = FastUnwrapUsable(receiver, options);
+    if (!stmt)
+    {
+        return 0;
+    }
+    int32_t column;
+    if (!ExactInt32(index, &column) || !stmt->HasColumn(column))
+    {
+        ThrowFastError(options, kNoSuchColumn, true);
+        return 0;
+    }
+    sqlite3_int64 value = sqlite3_column_int64(stmt->stmt_, column);
+    if (value < INT32_MIN || value > INT32_MAX)
+    {
+        ThrowFastError(options, "Column value does not fit in a 32-bit integer", true);
+        return 0;
+    }
+    return static_cast<int32_t>(value);
+}
+
+double Statement::FastGetDouble(Local<Object> receiver, double index, v8::FastApiCallbackOptions &options)
+{
+    Statement *stmt = FastUnwrapUsable(receiver, options);
+    if (!stmt)
+    {
+        return 0;
+    }
+    int32_t column;
+    if (!ExactInt32(index, &column) || !stmt->HasColumn(column))
+    {
+        ThrowFastError(options, kNoSuchColumn, true);
+        return 0;
+    }
+    return sqlite3_column_double(stmt->stmt_, column);
+}
+
+void Statement::FastBindInt(Local<Object> receiver, double index, double value, v8::FastApiCallbackOptions &options)
+{
+    Statement *stmt = FastUnwrapUsable(receiver, options);
+    if (!stmt)
+    {
+        return;
+    }
+    int32_t param, number;
+    if (!ExactInt32(index, &param) || !ExactInt32(value, &number))
+    {
+        ThrowFastError(options, "bindInt() takes a parameter index and a 32-bit integer");
+        return;
+    }
+    if (sqlite3_bind_int(stmt->stmt_, param, number) != SQLITE_OK)
+    {
+        ThrowFastError(options, kNoSuchParameter, true);
+    }
+}
+
+void Statement::FastBindDouble(Local<Object> receiver, double index, double value, v8::FastApiCallbackOptions &options)
+{
+    Statement *stmt = FastUnwrapUsable(receiver, options);
+    if (!stmt)
+    {
+        return;
+    }
+    int32_t param;
+    if (!ExactInt32(index, &param))
+    {
+        ThrowFastError(options, "bindDouble() takes a parameter index and a number");
+        return;
+    }
+    if (sqlite3_bind_double(stmt->stmt_, param, value) != SQLITE_OK)
+    {
+        ThrowFastError(options, kNoSuchParameter, true);
+    }
+}
+
+void Statement::SetFastMethod(Isolate *isolate, Local<FunctionTemplate> tpl, const char *name,
+                              v8::FunctionCallback slow, const v8::CFunction *fast)
+{
+    Local<String> key = String::NewFromUtf8(isolate, name, NewStringType::kInternalized).ToLocalChecked();
+    Local<FunctionTemplate> method = FunctionTemplate::New(
+        isolate, slow, Local<Value>(), v8::Signature::New(isolate, tpl), 0,
+        v8::ConstructorBehavior::kThrow, v8::SideEffectType::kHasSideEffect, fast);
+    method->SetClassName(key);
+    tpl->PrototypeTemplate()->Set(key, method);
+}
+#endif
+
+void Statement::Get(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    // get(params) binds, steps once and returns the first row. Parameters
+    // must come as an array or object: a number or string always names a
+    // column, so get(5) never binds 5.
+    if (args.Length() > 0 && ParameterBinder::IsParameterList(args[0]))
+    {
+        args.GetReturnValue().Set(stmt->GetFirstRow(args));
+        return;
+    }
+
+    if (!args[0]->IsNumber() && !args[0]->IsString())
+    {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "get() takes a column index or name, or parameters as an array or object", NewStringType::kNormal).ToLocalChecked()));
         return;
     }
 
@@ -148,18 +504,7 @@ void Statement::Get(const FunctionCallbackInfo<Value> &args)
     int colIndex;
     if (args[0]->IsString())
     {
-        String::Utf8Value colName(isolate, args[0]);
-        int colCount = sqlite3_column_count(stmt->stmt_);
-        colIndex = -1;
-        for (int i = 0; i < colCount; i++)
-        {
-            const char *name = sqlite3_column_name(stmt->stmt_, i);
-            if (name && strcmp(name, *colName) == 0)
-            {
-                colIndex = i;
-                break;
-            }
-        }
+        colIndex = stmt->FindColumn(isolate, args[0].As<String>());
         if (colIndex == -1)
         {
             isolate->ThrowException(Exception::RangeError(
@@ -169,7 +514,7 @@ void Statement::Get(const FunctionCallbackInfo<Value> &args)
     }
     else
     {
-        colIndex = args[0]->Int32Value(isolate->GetCurrentContext()).FromMaybe(0);
+        colIndex = args[0]->IsInt32() ? args[0].As<Int32>()->Value() : -1;
     }
 
     if (colIndex < 0 || colIndex >= sqlite3_column_count(stmt->stmt_))
@@ -185,60 +530,59 @@ void Statement::Get(const FunctionCallbackInfo<Value> &args)
 void Statement::Finalize(const FunctionCallbackInfo<Value> &args)
 {
     Statement *stmt = Unwrap(args.Holder());
+    if (stmt && stmt->stmt_ && stmt->db_->IsBusy())
+    {
+        Isolate *isolate = args.GetIsolate();
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is busy with an asynchronous operation", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
     if (stmt && stmt->stmt_)
     {
-        sqlite3_finalize(stmt->stmt_);
+        Isolate *isolate = args.GetIsolate();
+        stmt->db_->ReleaseStatement(isolate, stmt->sql_.Get(isolate), stmt->stmt_);
         stmt->stmt_ = nullptr;
+        stmt->sql_.Reset();
+        stmt->arena_.Reset();
+        stmt->blob_arena_.Reset();
+        stmt->interners_.clear();
     }
 }
 
-void Statement::Iterate(const FunctionCallbackInfo<Value> &args)
-{
-    args.GetReturnValue().Set(args.Holder());
-}
-
-void Statement::Iterator(const FunctionCallbackInfo<Value> &args)
-{
-    args.GetReturnValue().Set(args.Holder());
-}
-
 void Statement::Next(const FunctionCallbackInfo<Value> &args)
 {
     Isolate *isolate = args.GetIsolate();
-    Local<Context> context = isolate->GetCurrentContext();
 
     Statement *stmt = Unwrap(args.Holder());
     if (!stmt || !stmt->IsValid())
     {
         Local<Object> result = Object::New(isolate);
-        result->Set(context, String::NewFromUtf8(isolate, "done", NewStringType::kNormal).ToLocalChecked(),
+        result->Set(isolate->GetCurrentContext(), String::NewFromUtf8(isolate, "done", NewStringType::kNormal).ToLocalChecked(),
                     Boolean::New(isolate, true))
             .Check();
         args.GetReturnValue().Set(result);
         return;
     }
 
+    if (stmt->db_->IsBusy())
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is busy with an asynchronous operation", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
     int rc = sqlite3_step(stmt->stmt_);
 
     if (rc == SQLITE_ROW)
     {
-        Local<Object> result = Object::New(isolate);
-        result->Set(context, String::NewFromUtf8(isolate, "value", NewStringType::kNormal).ToLocalChecked(),
-                    stmt->GetCurrentRow(isolate))
-            .Check();
-        result->Set(context, String::NewFromUtf8(isolate, "done", NewStringType::kNormal).ToLocalChecked(),
-                    Boolean::New(isolate, false))
-            .Check();
-        args.GetReturnValue().Set(result);
+        args.GetReturnValue().Set(stmt->NewIteratorResult(isolate, stmt->GetCurrentRow(isolate), false));
     }
     else if (rc == SQLITE_DONE)
     {
         sqlite3_reset(stmt->stmt_);
-        Local<Object> result = Object::New(isolate);
-        result->Set(context, String::NewFromUtf8(isolate, "done", NewStringType::kNormal).ToLocalChecked(),
-                    Boolean::New(isolate, true))
-            .Check();
-        args.GetReturnValue().Set(result);
+        stmt->arena_.Reset();
+        stmt->blob_arena_.Reset();
+        args.GetReturnValue().Set(stmt->NewIteratorResult(isolate, Undefined(isolate), true));
     }
     else
     {
@@ -247,69 +591,1045 @@ void Statement::Next(const FunctionCallbackInfo<Value> &args)
     }
 }
 
+void Statement::NextBatch(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    if (args.Length() < 1 || !args[0]->IsUint32() || args[0].As<v8::Uint32>()->Value() == 0)
+    {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Batch size must be a positive integer", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    std::vector<Local<Value>> rows;
+    if (!stmt->StepRows(isolate, args[0].As<v8::Uint32>()->Value(), rows))
+    {
+        return;
+    }
+    args.GetReturnValue().Set(Array::New(isolate, rows.data(), rows.size()));
+}
+
+// Integers beyond 2^53 come back as BigInt so they survive the round trip
+static inline Local<Value> Int64ToJS(Isolate *isolate, sqlite3_int64 ival)
+{
+    if (ival >= -9007199254740992LL && ival <= 9007199254740992LL)
+    {
+        return Number::New(isolate, static_cast<double>(ival));
+    }
+    return BigInt::New(isolate, ival);
+}
+
 void Statement::Reset(const FunctionCallbackInfo<Value> &args)
 {
     Statement *stmt = Unwrap(args.Holder());
+    if (stmt && stmt->IsValid() && stmt->db_->IsBusy())
+    {
+        Isolate *isolate = args.GetIsolate();
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Database is busy with an asynchronous operation", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
     if (stmt && stmt->IsValid())
     {
         sqlite3_reset(stmt->stmt_);
+        stmt->arena_.Reset();
+        stmt->blob_arena_.Reset();
     }
 }
 
-inline v8::Local<v8::Value> SqliteColumnToJS(v8::Isolate *isolate, sqlite3_stmt *stmt, int index)
+void Statement::Bind(const FunctionCallbackInfo<Value> &args)
 {
-    using namespace v8;
-
-    int type = sqlite3_column_type(stmt, index);
-    switch (type)
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
     {
-    case SQLITE_INTEGER:
-    {
-        sqlite3_int64 ival = sqlite3_column_int64(stmt, index);
-        if (ival >= -9007199254740992LL && ival <= 9007199254740992LL)
-        {
-            return Number::New(isolate, static_cast<double>(ival));
-        }
-        else
-        {
-            return BigInt::New(isolate, ival);
-        }
+        return;
     }
-    case SQLITE_FLOAT:
-        return Number::New(isolate, sqlite3_column_double(stmt, index));
-    case SQLITE_TEXT:
+
+    if (!stmt->BindArguments(args))
     {
-        const void *text = sqlite3_column_text16(stmt, index);
-        int bytes = sqlite3_column_bytes16(stmt, index);
-        if (!text || bytes == 0)
-        {
-            return String::Empty(isolate);
-        }
+        return;
+    }
 
-        const uint16_t *utf16_data = static_cast<const uint16_t *>(text);
-        size_t length = bytes / 2;
-        auto extResource = new SQLiteExternalString(utf16_data, length);
+    args.GetReturnValue().Set(args.Holder());
+}
 
-        Local<String> extStr;
-        if (String::NewExternalTwoByte(isolate, extResource).ToLocal(&extStr))
-        {
-            return extStr;
-        }
-        else
-        {
-            delete extResource;
-            return String::NewFromTwoByte(isolate, utf16_data, NewStringType::kNormal, length).ToLocalChecked();
+void Statement::All(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    if (!stmt->BindArguments(args))
+    {
+        return;
+    }
+
+    std::vector<Local<Value>> rows;
+    if (!stmt->StepRows(isolate, UINT32_MAX, rows))
+    {
+        return;
+    }
+    args.GetReturnValue().Set(Array::New(isolate, rows.data(), rows.size()));
+}
+
+void Statement::Run(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    if (!stmt->BindArguments(args))
+    {
+        return;
+    }
+
+    sqlite3 *db = sqlite3_db_handle(stmt->stmt_);
+    int rc = sqlite3_step(stmt->stmt_);
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, sqlite3_errmsg(db), NewStringType::kNormal).ToLocalChecked()));
+        sqlite3_reset(stmt->stmt_);
+        return;
+    }
+    sqlite3_reset(stmt->stmt_);
+
+    MaybeLocal<Value> values[] = {Int64ToJS(isolate, sqlite3_changes64(db)), Int64ToJS(isolate, sqlite3_last_insert_rowid(db))};
+    args.GetReturnValue().Set(stmt->addon_data_->run_result_template.Get(isolate)->NewInstance(context, MemorySpan<MaybeLocal<Value>>(values, 2)));
+}
+
+void Statement::RunMany(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    if (args.Length() < 1 || !args[0]->IsArray())
+    {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Array of parameters required", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    Local<Array> rows = args[0].As<Array>();
+    uint32_t count = rows->Length();
+    Local<ArrayBuffer> rowids = ArrayBuffer::New(isolate, static_cast<size_t>(count) * sizeof(int64_t));
+    int64_t *rowidData = static_cast<int64_t *>(rowids->Data());
+
+    Database *database = stmt->db_;
+    bool nested;
+    if (!database->BeginTransaction(isolate, Database::kBegin, &nested))
+    {
+        return;
+    }
+
+    sqlite3 *db = sqlite3_db_handle(stmt->stmt_);
+    sqlite3_int64 changes = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // Each element is bound like a single argument to run()
+        Local<Value> row;
+        if (!rows->Get(context, i).ToLocal(&row) || !stmt->BindValues(isolate, &row, 1))
+        {
+            database->RollbackTransaction(nested);
+            return;
+        }
+
+        int rc = sqlite3_step(stmt->stmt_);
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+        {
+            isolate->ThrowException(Exception::Error(
+                String::NewFromUtf8(isolate, sqlite3_errmsg(db), NewStringType::kNormal).ToLocalChecked()));
+            sqlite3_reset(stmt->stmt_);
+            database->RollbackTransaction(nested);
+            return;
+        }
+        sqlite3_reset(stmt->stmt_);
+
+        changes += sqlite3_changes64(db);
+        rowidData[i] = sqlite3_last_insert_rowid(db);
+    }
+
+    if (!database->CommitTransaction(isolate, nested))
+    {
+        database->RollbackTransaction(nested);
+        return;
+    }
+
+    MaybeLocal<Value> values[] = {Int64ToJS(isolate, changes), BigInt64Array::New(rowids, 0, count)};
+    args.GetReturnValue().Set(stmt->addon_data_->run_many_result_template.Get(isolate)->NewInstance(context, MemorySpan<MaybeLocal<Value>>(values, 2)));
+}
+
+void Statement::RunColumns(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    if (args.Length() < 1)
+    {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Columns required", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    sqlite3_reset(stmt->stmt_);
+    sqlite3_clear_bindings(stmt->stmt_);
+
+    ParameterColumns columns;
+    if (!columns.Init(isolate, stmt->stmt_, stmt->binder_, args[0]))
+    {
+        return;
+    }
+
+    // Defaults to the length of the shortest column
+    uint32_t count = columns.RowCount();
+    if (args.Length() > 1 && !args[1]->IsUndefined())
+    {
+        if (!args[1]->IsUint32() || args[1].As<v8::Uint32>()->Value() > count)
+        {
+            isolate->ThrowException(Exception::RangeError(
+                String::NewFromUtf8(isolate, "Row count must be a non-negative integer no larger than every column", NewStringType::kNormal).ToLocalChecked()));
+            return;
+        }
+        count = args[1].As<v8::Uint32>()->Value();
+    }
+    else if (count == UINT32_MAX)
+    {
+        isolate->ThrowException(Exception::RangeError(
+            String::NewFromUtf8(isolate, "Row count required when no columns are given", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    Database *database = stmt->db_;
+    bool nested;
+    if (!database->BeginTransaction(isolate, Database::kBegin, &nested))
+    {
+        return;
+    }
+
+    sqlite3 *db = sqlite3_db_handle(stmt->stmt_);
+    sqlite3_int64 changes = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!columns.BindRow(isolate, stmt->stmt_, i))
+        {
+            database->RollbackTransaction(nested);
+            return;
+        }
+
+        int rc = sqlite3_step(stmt->stmt_);
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+        {
+            isolate->ThrowException(Exception::Error(
+                String::NewFromUtf8(isolate, sqlite3_errmsg(db), NewStringType::kNormal).ToLocalChecked()));
+            sqlite3_reset(stmt->stmt_);
+            database->RollbackTransaction(nested);
+            return;
+        }
+        sqlite3_reset(stmt->stmt_);
+        changes += sqlite3_changes64(db);
+    }
+
+    if (!database->CommitTransaction(isolate, nested))
+    {
+        database->RollbackTransaction(nested);
+        return;
+    }
+
+    MaybeLocal<Value> values[] = {Int64ToJS(isolate, changes), Int64ToJS(isolate, sqlite3_last_insert_rowid(db))};
+    args.GetReturnValue().Set(stmt->addon_data_->run_result_template.Get(isolate)->NewInstance(context, MemorySpan<MaybeLocal<Value>>(values, 2)));
+}
+
+void Statement::Raw(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    // Only affects rows built from now on, so it is fine while busy
+    Statement *stmt = Unwrap(args.Holder());
+    if (!stmt || !stmt->IsValid())
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    stmt->raw_ = args.Length() == 0 || args[0]->BooleanValue(isolate);
+    args.GetReturnValue().Set(args.Holder());
+}
+
+// Distinct values a column may show before interning gives up on it
+static constexpr size_t kDefaultInternMaxDistinct = 256;
+
+void Statement::Intern(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    // Only affects values read from now on, so it is fine while busy
+    Statement *stmt = Unwrap(args.Holder());
+    if (!stmt || !stmt->IsValid())
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    size_t maxDistinct = kDefaultInternMaxDistinct;
+    if (args.Length() > 0 && args[0]->IsObject())
+    {
+        Local<Value> value;
+        if (!args[0].As<Object>()->Get(context, String::NewFromUtf8(isolate, "maxDistinct", NewStringType::kInternalized).ToLocalChecked()).ToLocal(&value))
+        {
+            return;
+        }
+        if (!value->IsUndefined())
+        {
+            double limit = value->IsNumber() ? value.As<Number>()->Value() : 0;
+            if (!(limit >= 1 && limit <= UINT32_MAX) || limit != static_cast<double>(static_cast<uint32_t>(limit)))
+            {
+                isolate->ThrowException(Exception::RangeError(
+                    String::NewFromUtf8(isolate, "maxDistinct must be a positive integer", NewStringType::kNormal).ToLocalChecked()));
+                return;
+            }
+            maxDistinct = static_cast<size_t>(limit);
+        }
+    }
+    else if (args.Length() > 0 && !args[0]->BooleanValue(isolate))
+    {
+        maxDistinct = 0;
+    }
+
+    stmt->intern_max_distinct_ = maxDistinct;
+    stmt->interners_.clear();
+    args.GetReturnValue().Set(args.Holder());
+}
+
+void Statement::SetBlobMode(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    // Only affects values read from now on, so it is fine while busy
+    Statement *stmt = Unwrap(args.Holder());
+    if (!stmt || !stmt->IsValid())
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    BlobMode mode;
+    String::Utf8Value name(isolate, args[0]);
+    if (args.Length() < 1 || !args[0]->IsString() || !ParseBlobMode(*name, &mode))
+    {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "BLOB mode must be 'buffer', 'slab', 'uint8array', 'float32array' or 'float64array'",
+                                NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    stmt->blob_arena_.SetMode(mode);
+    stmt->blob_arena_.Reset();
+    args.GetReturnValue().Set(args.Holder());
+}
+
+StringInterner *Statement::ColumnInterner(int column)
+{
+    if (intern_max_distinct_ == 0)
+    {
+        return nullptr;
+    }
+    if (interners_.empty())
+    {
+        int colCount = sqlite3_column_count(stmt_);
+        interners_.reserve(colCount);
+        for (int i = 0; i < colCount; i++)
+        {
+            interners_.emplace_back(intern_max_distinct_);
+        }
+    }
+    return column < static_cast<int>(interners_.size()) ? &interners_[column] : nullptr;
+}
+
+void Statement::Columns(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    if (!stmt->column_names_initialized_)
+    {
+        stmt->InitializeColumnNames(isolate);
+    }
+
+    std::vector<Local<Value>> names;
+    names.reserve(stmt->cached_column_names_.size());
+    for (const auto &name : stmt->cached_column_names_)
+    {
+        names.push_back(name.Get(isolate));
+    }
+    args.GetReturnValue().Set(Array::New(isolate, names.data(), names.size()));
+}
+
+// Appends the current row to a columnar batch, throwing when it can't
+static bool AppendBatchRow(Isolate *isolate, sqlite3_stmt *stmt, ColumnarBatch &batch)
+{
+    switch (batch.AppendRow())
+    {
+    case ColumnarBatch::AppendResult::Ok:
+        return true;
+    case ColumnarBatch::AppendResult::TooLarge:
+        isolate->ThrowException(Exception::RangeError(
+            String::NewFromUtf8(isolate, "Column data exceeds 2 GiB in a single batch", NewStringType::kNormal).ToLocalChecked()));
+        return false;
+    default:
+    {
+        int column = batch.MismatchColumn();
+        std::string message = std::string("Column \"") + sqlite3_column_name(stmt, column) + "\" holds a " +
+                              StorageClassName(batch.MismatchType()) + " value, which its " +
+                              ColumnKindName(batch.Columns()[column].kind) + " type can't hold; CAST it in the query";
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, message.c_str(), NewStringType::kNormal).ToLocalChecked()));
+        return false;
+    }
+    }
+}
+
+void Statement::FetchColumns(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    // Without a limit the rest of the result set is fetched
+    double maxRows = -1;
+    if (args.Length() > 0 && !args[0]->IsUndefined())
+    {
+        if (!args[0]->IsNumber() || args[0].As<Number>()->Value() < 0)
+        {
+            isolate->ThrowException(Exception::TypeError(
+                String::NewFromUtf8(isolate, "maxRows must be a non-negative number", NewStringType::kNormal).ToLocalChecked()));
+            return;
+        }
+        maxRows = args[0].As<Number>()->Value();
+    }
+
+    bool bigint = false;
+    if (args.Length() > 1 && args[1]->IsObject())
+    {
+        Local<Value> option;
+        if (!args[1].As<Object>()->Get(context, stmt->addon_data_->bigint_string.Get(isolate)).ToLocal(&option))
+        {
+            return;
+        }
+        bigint = option->BooleanValue(isolate);
+    }
+
+    if (!stmt->column_names_initialized_)
+    {
+        stmt->InitializeColumnNames(isolate);
+    }
+
+    ColumnarBatch batch(stmt->stmt_, stmt->column_kinds_, bigint);
+    bool done = false;
+    while (maxRows < 0 || batch.RowCount() < maxRows)
+    {
+        int rc = sqlite3_step(stmt->stmt_);
+        if (rc == SQLITE_DONE)
+        {
+            sqlite3_reset(stmt->stmt_);
+            done = true;
+            break;
+        }
+        if (rc != SQLITE_ROW)
+        {
+            isolate->ThrowException(Exception::Error(
+                String::NewFromUtf8(isolate, sqlite3_errmsg(sqlite3_db_handle(stmt->stmt_)), NewStringType::kNormal).ToLocalChecked()));
+            sqlite3_reset(stmt->stmt_);
+            return;
+        }
+        if (!AppendBatchRow(isolate, stmt->stmt_, batch))
+        {
+            sqlite3_reset(stmt->stmt_);
+            return;
+        }
+    }
+
+    Local<Object> result = Object::New(isolate);
+    result->Set(context, String::NewFromUtf8(isolate, "rowCount", NewStringType::kNormal).ToLocalChecked(),
+                Number::New(isolate, static_cast<double>(batch.RowCount())))
+        .Check();
+    result->Set(context, String::NewFromUtf8(isolate, "done", NewStringType::kNormal).ToLocalChecked(),
+                Boolean::New(isolate, done))
+        .Check();
+    result->Set(context, String::NewFromUtf8(isolate, "columns", NewStringType::kNormal).ToLocalChecked(),
+                batch.ToJS(isolate, stmt->cached_column_names_))
+        .Check();
+    args.GetReturnValue().Set(result);
+}
+
+// Hands an encoded message to a Buffer without copying it
+static Local<Value> MessageToBuffer(Isolate *isolate, std::vector<uint8_t> &&bytes)
+{
+    auto *owned = new std::vector<uint8_t>(std::move(bytes));
+    return node::Buffer::New(
+               isolate, reinterpret_cast<char *>(owned->data()), owned->size(),
+               [](char *, void *hint)
+               { delete static_cast<std::vector<uint8_t> *>(hint); },
+               owned)
+        .ToLocalChecked();
+}
+
+// Steps the rest of the result set into Arrow record batches of up to
+// batchRows rows. Returns the messages of an IPC stream as Buffers: the
+// schema, the batches and the end-of-stream marker.
+void Statement::ToArrow(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    size_t batchRows = kDefaultArrowBatchRows;
+    if (args.Length() > 0 && args[0]->IsObject())
+    {
+        Local<Value> option;
+        if (!args[0].As<Object>()->Get(context, String::NewFromUtf8(isolate, "batchRows", NewStringType::kInternalized).ToLocalChecked()).ToLocal(&option))
+        {
+            return;
+        }
+        if (!option->IsUndefined())
+        {
+            double rows = option->IsNumber() ? option.As<Number>()->Value() : 0;
+            if (!(rows >= 1 && rows <= INT32_MAX) || rows != static_cast<double>(static_cast<int32_t>(rows)))
+            {
+                isolate->ThrowException(Exception::RangeError(
+                    String::NewFromUtf8(isolate, "batchRows must be a positive integer", NewStringType::kNormal).ToLocalChecked()));
+                return;
+            }
+            batchRows = static_cast<size_t>(rows);
+        }
+    }
+
+    std::vector<std::string> names;
+    int colCount = sqlite3_column_count(stmt->stmt_);
+    for (int i = 0; i < colCount; i++)
+    {
+        names.emplace_back(sqlite3_column_name(stmt->stmt_, i));
+    }
+
+    std::vector<Local<Value>> messages;
+    bool done = false;
+    while (!done)
+    {
+        // Integers are collected as int64, which is what Arrow stores
+        ColumnarBatch batch(stmt->stmt_, stmt->column_kinds_, true);
+        while (batch.RowCount() < batchRows)
+        {
+            int rc = sqlite3_step(stmt->stmt_);
+            if (rc == SQLITE_DONE)
+            {
+                sqlite3_reset(stmt->stmt_);
+                done = true;
+                break;
+            }
+            if (rc != SQLITE_ROW)
+            {
+                isolate->ThrowException(Exception::Error(
+                    String::NewFromUtf8(isolate, sqlite3_errmsg(sqlite3_db_handle(stmt->stmt_)), NewStringType::kNormal).ToLocalChecked()));
+                sqlite3_reset(stmt->stmt_);
+                return;
+            }
+            if (!AppendBatchRow(isolate, stmt->stmt_, batch))
+            {
+                sqlite3_reset(stmt->stmt_);
+                return;
+            }
+        }
+
+        // The first batch settles the kinds of untyped columns
+        if (messages.empty())
+        {
+            messages.push_back(MessageToBuffer(isolate, ArrowSchemaMessage(batch.Columns(), names)));
+        }
+        if (batch.RowCount() > 0)
+        {
+            messages.push_back(MessageToBuffer(isolate, ArrowRecordBatchMessage(batch.Columns(), batch.RowCount())));
+        }
+    }
+    messages.push_back(MessageToBuffer(isolate, ArrowEndOfStream()));
+
+    args.GetReturnValue().Set(Array::New(isolate, messages.data(), messages.size()));
+}
+
+// Reads the (fd | path, { format, header }) arguments of exportTo()
+static bool ExportArguments(const FunctionCallbackInfo<Value> &args, ExportTarget *target, ExportOptions *options)
+{
+    Isolate *isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    if (args.Length() > 0 && args[0]->IsString())
+    {
+        String::Utf8Value path(isolate, args[0]);
+        target->path = *path ? *path : "";
+    }
+    else if (args.Length() > 0 && args[0]->IsInt32() && args[0].As<Int32>()->Value() >= 0)
+    {
+        target->fd = args[0].As<Int32>()->Value();
+    }
+    if (target->fd < 0 && target->path.empty())
+    {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "File descriptor or path required", NewStringType::kNormal).ToLocalChecked()));
+        return false;
+    }
+
+    if (args.Length() > 1 && args[1]->IsObject())
+    {
+        Local<Object> object = args[1].As<Object>();
+        Local<Value> value;
+        if (!object->Get(context, String::NewFromUtf8(isolate, "format", NewStringType::kInternalized).ToLocalChecked()).ToLocal(&value))
+        {
+            return false;
+        }
+        if (!value->IsUndefined())
+        {
+            String::Utf8Value name(isolate, value);
+            if (!value->IsString() || !*name || !ParseExportFormat(*name, &options->format))
+            {
+                isolate->ThrowException(Exception::TypeError(
+                    String::NewFromUtf8(isolate, "format must be 'csv' or 'ndjson'", NewStringType::kNormal).ToLocalChecked()));
+                return false;
+            }
+        }
+
+        if (!object->Get(context, String::NewFromUtf8(isolate, "header", NewStringType::kInternalized).ToLocalChecked()).ToLocal(&value))
+        {
+            return false;
+        }
+        if (!value->IsUndefined())
+        {
+            options->header = value->BooleanValue(isolate);
+        }
+    }
+    return true;
+}
+
+// Writes the rest of the result set to a file without creating any JS
+// values, and returns the number of rows written
+void Statement::ExportTo(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = UnwrapUsable(args);
+    if (!stmt)
+    {
+        return;
+    }
+
+    ExportTarget target;
+    ExportOptions options;
+    if (!ExportArguments(args, &target, &options))
+    {
+        return;
+    }
+
+    uint64_t rows;
+    std::string error;
+    if (!ExportRows(stmt->stmt_, target, options, &rows, &error))
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, error.c_str(), NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(rows)));
+}
+
+// Base for queries stepped on the threadpool. Parameters are held until the
+// work reaches the front of the database's queue and bound right before it
+// runs, since the connection may be in use by earlier work until then.
+class StatementWork : public AsyncWork
+{
+public:
+    StatementWork(const FunctionCallbackInfo<Value> &args, Statement *stmt, const char *name)
+        : AsyncWork(args.GetIsolate(), stmt->db_, args.Holder(), name), stmt_(stmt)
+    {
+        for (int i = 0; i < args.Length(); i++)
+        {
+            params_.emplace_back(args.GetIsolate(), args[i]);
+        }
+    }
+
+protected:
+    bool Setup(Isolate *isolate) override
+    {
+        if (!stmt_->IsValid())
+        {
+            isolate->ThrowException(Exception::Error(
+                String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+            return false;
+        }
+
+        std::vector<Local<Value>> values;
+        values.reserve(params_.size());
+        for (auto &param : params_)
+        {
+            values.push_back(param.Get(isolate));
+        }
+        return stmt_->BindValues(isolate, values.data(), static_cast<int>(values.size()));
+    }
+
+    Statement *stmt_;
+
+private:
+    std::vector<Global<Value>> params_;
+};
+
+class AllWork : public StatementWork
+{
+public:
+    // Rows take the shape the statement had when the query was issued
+    AllWork(const FunctionCallbackInfo<Value> &args, Statement *stmt)
+        : StatementWork(args, stmt, "mo-betta-sqlite3:all"), raw_(stmt->raw_), rows_(stmt->binder_.Encoding()) {}
+
+protected:
+    void Execute() override
+    {
+        sqlite3_stmt *handle = stmt_->stmt_;
+        int rc;
+        while ((rc = sqlite3_step(handle)) == SQLITE_ROW)
+        {
+            rows_.Capture(handle);
+        }
+        if (rc != SQLITE_DONE)
+        {
+            error_ = sqlite3_errmsg(sqlite3_db_handle(handle));
+        }
+        sqlite3_reset(handle);
+    }
+
+    Local<Value> Complete(Isolate *isolate) override
+    {
+        size_t count = rows_.RowCount();
+        std::vector<Local<Value>> rows;
+        rows.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            rows.push_back(stmt_->GetStagedRow(isolate, rows_, i, raw_));
+        }
+        return Array::New(isolate, rows.data(), rows.size());
+    }
+
+private:
+    bool raw_;
+    RowBuffer rows_;
+};
+
+class RunWork : public StatementWork
+{
+public:
+    RunWork(const FunctionCallbackInfo<Value> &args, Statement *stmt)
+        : StatementWork(args, stmt, "mo-betta-sqlite3:run") {}
+
+protected:
+    void Execute() override
+    {
+        sqlite3_stmt *handle = stmt_->stmt_;
+        sqlite3 *db = sqlite3_db_handle(handle);
+        int rc = sqlite3_step(handle);
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+        {
+            error_ = sqlite3_errmsg(db);
+        }
+        changes_ = sqlite3_changes64(db);
+        last_insert_rowid_ = sqlite3_last_insert_rowid(db);
+        sqlite3_reset(handle);
+    }
+
+    Local<Value> Complete(Isolate *isolate) override
+    {
+        MaybeLocal<Value> values[] = {Int64ToJS(isolate, changes_), Int64ToJS(isolate, last_insert_rowid_)};
+        return stmt_->addon_data_->run_result_template.Get(isolate)->NewInstance(
+            isolate->GetCurrentContext(), MemorySpan<MaybeLocal<Value>>(values, 2));
+    }
+
+private:
+    sqlite3_int64 changes_ = 0;
+    sqlite3_int64 last_insert_rowid_ = 0;
+};
+
+// Runs exportTo() on the threadpool. The arguments are read right away;
+// the rows are those of the statement's bindings when the work starts.
+class ExportWork : public AsyncWork
+{
+public:
+    ExportWork(const FunctionCallbackInfo<Value> &args, Statement *stmt, ExportTarget target, ExportOptions options)
+        : AsyncWork(args.GetIsolate(), stmt->db_, args.Holder(), "mo-betta-sqlite3:export"), stmt_(stmt),
+          target_(std::move(target)), options_(options), rows_(0) {}
+
+protected:
+    bool Setup(Isolate *isolate) override
+    {
+        if (!stmt_->IsValid())
+        {
+            isolate->ThrowException(Exception::Error(
+                String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+            return false;
+        }
+        return true;
+    }
+
+    void Execute() override
+    {
+        ExportRows(stmt_->stmt_, target_, options_, &rows_, &error_);
+    }
+
+    Local<Value> Complete(Isolate *isolate) override
+    {
+        return Number::New(isolate, static_cast<double>(rows_));
+    }
+
+private:
+    Statement *stmt_;
+    ExportTarget target_;
+    ExportOptions options_;
+    uint64_t rows_;
+};
+
+void Statement::AllAsync(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = Unwrap(args.Holder());
+    if (!stmt || !stmt->IsValid())
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    // Queued behind any other work on the same connection
+    auto work = new AllWork(args, stmt);
+    args.GetReturnValue().Set(work->GetPromise(isolate));
+    stmt->db_->Schedule(work);
+}
+
+void Statement::RunAsync(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = Unwrap(args.Holder());
+    if (!stmt || !stmt->IsValid())
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    auto work = new RunWork(args, stmt);
+    args.GetReturnValue().Set(work->GetPromise(isolate));
+    stmt->db_->Schedule(work);
+}
+
+void Statement::ExportToAsync(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = Unwrap(args.Holder());
+    if (!stmt || !stmt->IsValid())
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    ExportTarget target;
+    ExportOptions options;
+    if (!ExportArguments(args, &target, &options))
+    {
+        return;
+    }
+
+    auto work = new ExportWork(args, stmt, std::move(target), options);
+    args.GetReturnValue().Set(work->GetPromise(isolate));
+    stmt->db_->Schedule(work);
+}
+
+bool Statement::StepRows(Isolate *isolate, uint32_t maxRows, std::vector<Local<Value>> &rows)
+{
+    rows.reserve(maxRows < 256 ? maxRows : 256);
+
+    while (rows.size() < maxRows)
+    {
+        int rc = sqlite3_step(stmt_);
+        if (rc == SQLITE_ROW)
+        {
+            rows.push_back(GetCurrentRow(isolate));
+            continue;
+        }
+
+        if (rc != SQLITE_DONE)
+        {
+            isolate->ThrowException(Exception::Error(
+                String::NewFromUtf8(isolate, sqlite3_errmsg(sqlite3_db_handle(stmt_)), NewStringType::kNormal).ToLocalChecked()));
+        }
+        sqlite3_reset(stmt_);
+        arena_.Reset();
+        blob_arena_.Reset();
+        return rc == SQLITE_DONE;
+    }
+
+    return true;
+}
+
+Local<Object> Statement::NewIteratorResult(Isolate *isolate, Local<Value> value, bool done)
+{
+    // One shared map for every {value, done} pair instead of two keyed stores
+    MaybeLocal<Value> values[] = {value, Boolean::New(isolate, done)};
+    return addon_data_->iterator_result_template.Get(isolate)->NewInstance(isolate->GetCurrentContext(), MemorySpan<MaybeLocal<Value>>(values, 2));
+}
+
+bool Statement::BindArguments(const FunctionCallbackInfo<Value> &args)
+{
+    int argc = args.Length();
+    std::vector<Local<Value>> values;
+    values.reserve(argc);
+    for (int i = 0; i < argc; i++)
+    {
+        values.push_back(args[i]);
+    }
+
+    return BindValues(args.GetIsolate(), values.data(), argc);
+}
+
+bool Statement::BindValues(Isolate *isolate, const Local<Value> *values, int count)
+{
+    sqlite3_reset(stmt_);
+
+    // Without arguments the statement keeps whatever was bound last
+    if (count == 0)
+    {
+        return true;
+    }
+
+    return binder_.Bind(isolate, stmt_, values, count);
+}
+
+Local<Value> Statement::GetFirstRow(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    if (!BindArguments(args))
+    {
+        return Undefined(isolate);
+    }
+
+    int rc = sqlite3_step(stmt_);
+    if (rc == SQLITE_ROW)
+    {
+        return GetCurrentRow(isolate);
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, sqlite3_errmsg(sqlite3_db_handle(stmt_)), NewStringType::kNormal).ToLocalChecked()));
+    }
+    sqlite3_reset(stmt_);
+    return Undefined(isolate);
+}
+
+// Text is read in the connection's encoding and handed to the string
+// helpers of text_encoding.h
+inline v8::Local<v8::Value> SqliteColumnToJS(v8::Isolate *isolate, sqlite3_stmt *stmt, int index, RowArena &arena,
+                                             TextEncoding encoding, StringInterner *interner, BlobArena &blobs)
+{
+    using namespace v8;
+
+    int type = sqlite3_column_type(stmt, index);
+    switch (type)
+    {
+    case SQLITE_INTEGER:
+        return Int64ToJS(isolate, sqlite3_column_int64(stmt, index));
+    case SQLITE_FLOAT:
+        return Number::New(isolate, sqlite3_column_double(stmt, index));
+    case SQLITE_TEXT:
+    {
+        // SQLite reuses its buffer on the next step, so external strings
+        // point at a copy pinned in the statement's row arena instead
+        if (encoding == TextEncoding::Utf8)
+        {
+            const char *utf8 = reinterpret_cast<const char *>(sqlite3_column_text(stmt, index));
+            int length = sqlite3_column_bytes(stmt, index);
+            if (!utf8 || length == 0)
+            {
+                return String::Empty(isolate);
+            }
+            Local<String> interned;
+            if (interner && interner->Get(isolate, utf8, length, StringInterner::Kind::Utf8).ToLocal(&interned))
+            {
+                return interned;
+            }
+            return NewUtf8String(isolate, utf8, length, arena);
+        }
+
+        const void *text = sqlite3_column_text16(stmt, index);
+        int bytes = sqlite3_column_bytes16(stmt, index);
+        if (!text || bytes == 0)
+        {
+            return String::Empty(isolate);
+        }
+        Local<String> interned;
+        if (interner && interner->Get(isolate, text, bytes, StringInterner::Kind::Utf16).ToLocal(&interned))
+        {
+            return interned;
         }
+        return NewUtf16String(isolate, static_cast<const uint16_t *>(text), bytes / 2, arena);
     }
     case SQLITE_BLOB:
     {
         const void *blob = sqlite3_column_blob(stmt, index);
         int len = sqlite3_column_bytes(stmt, index);
-        if (!blob || len == 0)
-        {
-            return node::Buffer::New(isolate, 0).ToLocalChecked();
-        }
-        return node::Buffer::Copy(isolate, static_cast<const char *>(blob), len).ToLocalChecked();
+        return blobs.ToJS(isolate, blob, blob ? len : 0);
     }
     default:
         return Null(isolate);
@@ -317,7 +1637,76 @@ inline v8::Local<v8::Value> SqliteColumnToJS(v8::Isolate *isolate, sqlite3_stmt
 }
 Local<Value> Statement::GetColumnValue(Isolate *isolate, int columnIndex)
 {
-    return SqliteColumnToJS(isolate, stmt_, columnIndex);
+    return SqliteColumnToJS(isolate, stmt_, columnIndex, arena_, binder_.Encoding(), ColumnInterner(columnIndex), blob_arena_);
+}
+
+// DictionaryTemplate can only declare named properties, not elements
+static bool IsArrayIndex(const char *name)
+{
+    size_t length = strlen(name);
+    if (length == 0 || length > 10 || (name[0] == '0' && length > 1))
+    {
+        return false;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (name[i] < '0' || name[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (name[i] - '0');
+    }
+    return value < 4294967295ULL;
+}
+
+void Statement::ColumnIndex(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = Unwrap(args.Holder());
+    if (!stmt || !stmt->IsValid())
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, "Statement is finalized", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    if (!args[0]->IsString())
+    {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Column name required", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+
+    int index = stmt->FindColumn(isolate, args[0].As<String>());
+    if (index == -1)
+    {
+        isolate->ThrowException(Exception::RangeError(
+            String::NewFromUtf8(isolate, "Column name not found", NewStringType::kNormal).ToLocalChecked()));
+        return;
+    }
+    args.GetReturnValue().Set(index);
+}
+
+// Compares by hash first; a name written as a literal is internalized like
+// the cached names, so the content comparison is then a pointer check.
+// With duplicate names the first column wins.
+int Statement::FindColumn(Isolate *isolate, Local<String> name)
+{
+    InitializeColumnNames(isolate);
+
+    int found = -1;
+    auto range = column_index_.equal_range(name->GetIdentityHash());
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        int index = it->second;
+        if ((found == -1 || index < found) && cached_column_names_[index].Get(isolate)->StringEquals(name))
+        {
+            found = index;
+        }
+    }
+    return found;
 }
 
 void Statement::InitializeColumnNames(Isolate *isolate)
@@ -328,20 +1717,37 @@ void Statement::InitializeColumnNames(Isolate *isolate)
     int colCount = sqlite3_column_count(stmt_);
     cached_column_names_.reserve(colCount);
 
+    std::vector<std::string_view> names;
+    names.reserve(colCount);
+    bool shareable = true;
+
     for (int i = 0; i < colCount; i++)
     {
         const char *colName = sqlite3_column_name(stmt_, i);
         Local<String> nameStr = String::NewFromUtf8(isolate, colName, NewStringType::kInternalized).ToLocalChecked();
         cached_column_names_.emplace_back(isolate, nameStr);
+        column_index_.emplace(nameStr->GetIdentityHash(), i);
+
+        if (IsArrayIndex(colName) || std::find(names.begin(), names.end(), colName) != names.end())
+        {
+            shareable = false;
+        }
+        names.emplace_back(colName);
+    }
+
+    if (shareable)
+    {
+        row_template_.Reset(isolate, DictionaryTemplate::New(isolate, MemorySpan<const std::string_view>(names.data(), names.size())));
+        row_values_.resize(colCount);
     }
 
     column_names_initialized_ = true;
 }
 
-Local<Object> Statement::GetCurrentRow(Isolate *isolate)
+template <typename ValueAt>
+Local<Object> Statement::BuildRow(Isolate *isolate, int colCount, bool raw, ValueAt valueAt)
 {
     Local<Context> context = isolate->GetCurrentContext();
-    Local<Object> row = Object::New(isolate);
 
     // Initialize column names cache if needed
     if (!column_names_initialized_)
@@ -349,11 +1755,32 @@ Local<Object> Statement::GetCurrentRow(Isolate *isolate)
         InitializeColumnNames(isolate);
     }
 
-    int colCount = sqlite3_column_count(stmt_);
+    if (raw)
+    {
+        raw_values_.resize(colCount);
+        for (int i = 0; i < colCount; i++)
+        {
+            raw_values_[i] = valueAt(i);
+        }
+        return Array::New(isolate, raw_values_.data(), colCount);
+    }
+
+    // Every row shares the template's map, so all properties are filled in
+    // one call without per-column stores or map transitions
+    if (!row_template_.IsEmpty())
+    {
+        for (int i = 0; i < colCount; i++)
+        {
+            row_values_[i] = valueAt(i);
+        }
+        return row_template_.Get(isolate)->NewInstance(context, MemorySpan<MaybeLocal<Value>>(row_values_.data(), row_values_.size()));
+    }
+
+    Local<Object> row = Object::New(isolate);
     for (int i = 0; i < colCount; i++)
     {
         Local<String> colName = cached_column_names_[i].Get(isolate);
-        Local<Value> value = SqliteColumnToJS(isolate, stmt_, i);
+        Local<Value> value = valueAt(i);
 
         row->Set(context, colName, value).Check();
     }
@@ -361,13 +1788,90 @@ Local<Object> Statement::GetCurrentRow(Isolate *isolate)
     return row;
 }
 
+Local<Object> Statement::GetCurrentRow(Isolate *isolate)
+{
+    return BuildRow(isolate, sqlite3_column_count(stmt_), raw_,
+                    [&](int i) { return SqliteColumnToJS(isolate, stmt_, i, arena_, binder_.Encoding(), ColumnInterner(i), blob_arena_); });
+}
+
+Local<Object> Statement::GetStagedRow(Isolate *isolate, RowBuffer &buffer, size_t row, bool raw)
+{
+    return BuildRow(isolate, buffer.ColumnCount(), raw,
+                    [&](int i) { return buffer.CellToJS(isolate, row, i, ColumnInterner(i), blob_arena_); });
+}
+
+Statement *Statement::UnwrapUsable(const FunctionCallbackInfo<Value> &args)
+{
+    Isolate *isolate = args.GetIsolate();
+
+    Statement *stmt = Unwrap(args.Holder());
+    const char *error = stmt ? stmt->UsableError() : "Statement is finalized";
+    if (error)
+    {
+        isolate->ThrowException(Exception::Error(
+            String::NewFromUtf8(isolate, error, NewStringType::kNormal).ToLocalChecked()));
+        return nullptr;
+    }
+
+    return stmt;
+}
+
+const char *Statement::UsableError() const
+{
+    if (!stmt_)
+    {
+        return "Statement is finalized";
+    }
+    if (db_->IsBusy())
+    {
+        return "Database is busy with an asynchronous operation";
+    }
+    return nullptr;
+}
+
 Statement *Statement::Unwrap(Local<Object> obj)
 {
-    Local<External> external = Local<External>::Cast(obj->GetInternalField(0));
-    return static_cast<Statement *>(external->Value());
+    return static_cast<Statement *>(obj->GetAlignedPointerFromInternalField(0));
 }
 
 void Statement::Wrap(Local<Object> obj)
 {
-    obj->SetInternalField(0, External::New(obj->GetIsolate(), this));
+    obj->SetAlignedPointerInInternalField(0, this);
+    handle_.Reset(obj->GetIsolate(), obj);
+    handle_.SetWeak(this, WeakCallback, v8::WeakCallbackType::kParameter);
+}
+
+void Statement::WeakCallback(const v8::WeakCallbackInfo<Statement> &info)
+{
+    info.GetParameter()->handle_.Reset();
+    info.SetSecondPassCallback(Collect);
+}
+
+// A statement that was never finalized gives its handle back like
+// finalize() would
+void Statement::Collect(const v8::WeakCallbackInfo<Statement> &info)
+{
+    Isolate *isolate = info.GetIsolate();
+    HandleScope scope(isolate);
+
+    Statement *stmt = info.GetParameter();
+    if (stmt->stmt_)
+    {
+        stmt->db_->ReleaseStatement(isolate, stmt->sql_.Get(isolate), stmt->stmt_);
+        stmt->stmt_ = nullptr;
+    }
+    stmt->db_->UnregisterStatement(stmt);
+    delete stmt;
+}
+
+void Statement::Invalidate()
+{
+    if (stmt_)
+    {
+        sqlite3_finalize(stmt_);
+        stmt_ = nullptr;
+        arena_.Reset();
+        blob_arena_.Reset();
+        interners_.clear();
+    }
 }
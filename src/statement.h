@@ -3,43 +3,169 @@
 #include <v8.h>
 #include <node.h>
 #include <sqlite3.h>
+#include <unordered_map>
 #include <vector>
 
+// Fast API calls need the v8-fast-api-calls.h header, which the headers of
+// some Node releases (Node 22 among them) don't install. Elsewhere the same
+// methods are registered as regular callbacks.
+#if __has_include(<v8-fast-api-calls.h>)
+#include <v8-fast-api-calls.h>
+#define MO_BETTA_FAST_API 1
+// Before V8 13 a fast call can't throw. It sets
+// FastApiCallbackOptions::fallback instead, and V8 runs the regular
+// callback in its place, which throws.
+#if V8_MAJOR_VERSION < 13
+#define MO_BETTA_FAST_API_FALLBACK 1
+#endif
+#endif
+
+#include "binder.h"
+#include "blob_arena.h"
+#include "columnar.h"
+#include "external_string.h"
+#include "row_buffer.h"
+#include "row_export.h"
+#include "string_interner.h"
+
 class Database;
+struct AddonData;
 
 class Statement {
 public:
-    static void Init(v8::Local<v8::Object> exports);
-    static v8::Local<v8::Object> NewInstance(v8::Isolate* isolate, sqlite3_stmt* stmt, Database* db);
+    static void Init(v8::Local<v8::Object> exports, AddonData* addon_data);
+    static v8::Local<v8::Object> NewInstance(v8::Isolate* isolate, sqlite3_stmt* stmt, Database* db,
+                                             v8::Local<v8::Object> database, v8::Local<v8::String> sql);
     
     static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void Step(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void Get(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void Finalize(const v8::FunctionCallbackInfo<v8::Value>& args);
-    static void Iterate(const v8::FunctionCallbackInfo<v8::Value>& args);
-    static void Iterator(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void Next(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void NextBatch(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void Reset(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void GetInt(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void GetDouble(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void BindInt(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void BindDouble(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Bind(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void All(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Run(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void RunMany(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void RunColumns(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Raw(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Intern(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void SetBlobMode(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Columns(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void ColumnIndex(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void FetchColumns(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void ToArrow(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void ExportTo(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void ExportToAsync(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void AllAsync(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void RunAsync(const v8::FunctionCallbackInfo<v8::Value>& args);
 
     sqlite3_stmt* GetStmt() const { return stmt_; }
     bool IsValid() const { return stmt_ != nullptr; }
 
+    // Finalizes the handle when the database closes underneath the statement
+    void Invalidate();
+
 private:
+    friend class StatementWork;
+    friend class AllWork;
+    friend class RunWork;
+    friend class ExportWork;
+
+    friend class Database;
+
     Statement(sqlite3_stmt* stmt, Database* db);
     ~Statement();
 
-    static v8::Persistent<v8::Function> constructor;
+    static void WeakCallback(const v8::WeakCallbackInfo<Statement>& info);
+    static void Collect(const v8::WeakCallbackInfo<Statement>& info);
+
     sqlite3_stmt* stmt_;
     Database* db_;
+    AddonData* addon_data_;
+
+    // Key under which the handle goes back to the statement cache
+    v8::Global<v8::String> sql_;
+
+    v8::Global<v8::Object> handle_;
     
     // Cached column names for performance
     std::vector<v8::Global<v8::String>> cached_column_names_;
     bool column_names_initialized_;
+
+    // Column indexes by name hash, built with the names
+    std::unordered_multimap<int, int> column_index_;
+
+    // Fixed object shape for rows, built together with the column names.
+    // Empty when the names can't share one shape (duplicates or array
+    // indices), in which case rows are built property by property.
+    v8::Global<v8::DictionaryTemplate> row_template_;
+    std::vector<v8::MaybeLocal<v8::Value>> row_values_;
+
+    // In raw mode rows are dense arrays in column order
+    bool raw_;
+    std::vector<v8::Local<v8::Value>> raw_values_;
+
+    ParameterBinder binder_;
+
+    // Column layout shared by every fetchColumns() batch
+    std::vector<ColumnKind> column_kinds_;
+
+    // Owns copies of column text handed to V8 as external strings
+    RowArena arena_;
+
+    // Packs BLOB values per blobMode(); reset with the row arena
+    BlobArena blob_arena_;
+
+    // Text columns share strings for repeated values while intern() is on,
+    // which it is when the limit is non-zero. One interner per column,
+    // created with the first row.
+    size_t intern_max_distinct_;
+    std::vector<StringInterner> interners_;
+    StringInterner* ColumnInterner(int column);
     
     v8::Local<v8::Value> GetColumnValue(v8::Isolate* isolate, int columnIndex);
     v8::Local<v8::Object> GetCurrentRow(v8::Isolate* isolate);
+    v8::Local<v8::Object> GetStagedRow(v8::Isolate* isolate, RowBuffer& buffer, size_t row, bool raw);
+    template <typename ValueAt>
+    v8::Local<v8::Object> BuildRow(v8::Isolate* isolate, int colCount, bool raw, ValueAt valueAt);
     void InitializeColumnNames(v8::Isolate* isolate);
+    // Index of the column called `name`, or -1
+    int FindColumn(v8::Isolate* isolate, v8::Local<v8::String> name);
+    bool StepRows(v8::Isolate* isolate, uint32_t maxRows, std::vector<v8::Local<v8::Value>>& rows);
+    v8::Local<v8::Object> NewIteratorResult(v8::Isolate* isolate, v8::Local<v8::Value> value, bool done);
+    bool BindArguments(const v8::FunctionCallbackInfo<v8::Value>& args);
+    bool BindValues(v8::Isolate* isolate, const v8::Local<v8::Value>* values, int count);
+    v8::Local<v8::Value> GetFirstRow(const v8::FunctionCallbackInfo<v8::Value>& args);
     
     static Statement* Unwrap(v8::Local<v8::Object> obj);
+    // Unwraps the receiver, throwing if it is finalized or its database is busy
+    static Statement* UnwrapUsable(const v8::FunctionCallbackInfo<v8::Value>& args);
     void Wrap(v8::Local<v8::Object> obj);
+
+    // Null when the statement can be used, else why not
+    const char* UsableError() const;
+    bool HasColumn(int index) const;
+
+#ifdef MO_BETTA_FAST_API
+#ifdef MO_BETTA_FAST_API_FALLBACK
+    // Set when a fast step() fails: the regular callback that V8 runs
+    // instead then throws the step's error rather than stepping again
+    bool fast_step_failed_ = false;
+#endif
+    static Statement* FastUnwrapUsable(v8::Local<v8::Object> receiver, v8::FastApiCallbackOptions& options);
+    static bool FastStep(v8::Local<v8::Object> receiver, v8::FastApiCallbackOptions& options);
+    static void FastReset(v8::Local<v8::Object> receiver, v8::FastApiCallbackOptions& options);
+    static int32_t FastGetInt(v8::Local<v8::Object> receiver, double index, v8::FastApiCallbackOptions& options);
+    static double FastGetDouble(v8::Local<v8::Object> receiver, double index, v8::FastApiCallbackOptions& options);
+    static void FastBindInt(v8::Local<v8::Object> receiver, double index, double value, v8::FastApiCallbackOptions& options);
+    static void FastBindDouble(v8::Local<v8::Object> receiver, double index, double value, v8::FastApiCallbackOptions& options);
+    static void SetFastMethod(v8::Isolate* isolate, v8::Local<v8::FunctionTemplate> tpl, const char* name,
+                              v8::FunctionCallback slow, const v8::CFunction* fast);
+#endif
 };
@@ -0,0 +1,70 @@
+#include "statement_cache.h"
+#include <iterator>
+
+using v8::Isolate;
+using v8::Local;
+using v8::String;
+
+StatementCache::StatementCache(size_t capacity) : capacity_(capacity), hits_(0), misses_(0) {
+}
+
+StatementCache::~StatementCache() {
+    Clear();
+}
+
+sqlite3_stmt* StatementCache::Take(Isolate* isolate, Local<String> sql) {
+    if (capacity_ > 0) {
+        auto range = index_.equal_range(sql->GetIdentityHash());
+        for (auto it = range.first; it != range.second; ++it) {
+            auto entry = it->second;
+            if (entry->sql.Get(isolate)->StringEquals(sql)) {
+                sqlite3_stmt* stmt = entry->stmt;
+                index_.erase(it);
+                entries_.erase(entry);
+                hits_++;
+                return stmt;
+            }
+        }
+    }
+    misses_++;
+    return nullptr;
+}
+
+void StatementCache::Put(Isolate* isolate, Local<String> sql, sqlite3_stmt* stmt) {
+    if (capacity_ == 0) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    int hash = sql->GetIdentityHash();
+    entries_.push_front(Entry{hash, v8::Global<String>(isolate, sql), stmt});
+    index_.emplace(hash, entries_.begin());
+
+    if (entries_.size() > capacity_) {
+        Evict();
+    }
+}
+
+void StatementCache::Evict() {
+    auto last = std::prev(entries_.end());
+    auto range = index_.equal_range(last->hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == last) {
+            index_.erase(it);
+            break;
+        }
+    }
+    sqlite3_finalize(last->stmt);
+    entries_.erase(last);
+}
+
+void StatementCache::Clear() {
+    for (auto& entry : entries_) {
+        sqlite3_finalize(entry.stmt);
+    }
+    entries_.clear();
+    index_.clear();
+}
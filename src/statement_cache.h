@@ -0,0 +1,53 @@
+#pragma once
+
+#include <v8.h>
+#include <sqlite3.h>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+// Idle prepared statements of one connection, keyed by their SQL text.
+//
+// A statement leaves the cache while a Statement object uses it and comes
+// back, reset, when that object is finalized. Lookups compare V8 strings
+// by hash and content, so a hit never converts the SQL to UTF-8. Once the
+// cache is over capacity the least recently returned statement is
+// finalized.
+class StatementCache {
+public:
+    explicit StatementCache(size_t capacity);
+    ~StatementCache();
+
+    StatementCache(const StatementCache&) = delete;
+    StatementCache& operator=(const StatementCache&) = delete;
+
+    // Removes and returns an idle statement for `sql`, or nullptr
+    sqlite3_stmt* Take(v8::Isolate* isolate, v8::Local<v8::String> sql);
+
+    // Resets `stmt` and keeps it for the next Take() of the same SQL
+    void Put(v8::Isolate* isolate, v8::Local<v8::String> sql, sqlite3_stmt* stmt);
+
+    // Finalizes every idle statement
+    void Clear();
+
+    size_t Capacity() const { return capacity_; }
+    size_t Size() const { return entries_.size(); }
+    uint64_t Hits() const { return hits_; }
+    uint64_t Misses() const { return misses_; }
+
+private:
+    struct Entry {
+        int hash;
+        v8::Global<v8::String> sql;
+        sqlite3_stmt* stmt;
+    };
+
+    // Most recently returned first
+    std::list<Entry> entries_;
+    std::unordered_multimap<int, std::list<Entry>::iterator> index_;
+    size_t capacity_;
+    uint64_t hits_;
+    uint64_t misses_;
+
+    void Evict();
+};
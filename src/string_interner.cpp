@@ -0,0 +1,56 @@
+#include "string_interner.h"
+#include <cstdint>
+#include <string_view>
+
+using v8::Isolate;
+using v8::Local;
+using v8::MaybeLocal;
+using v8::NewStringType;
+using v8::String;
+
+// Labels and codes are short; longer text is rarely repeated and costs more
+// to hash than it saves
+static constexpr size_t kMaxInternedBytes = 128;
+
+MaybeLocal<String> StringInterner::Get(Isolate* isolate, const void* data, size_t size, Kind kind) {
+    if (!enabled_ || size > kMaxInternedBytes) {
+        return MaybeLocal<String>();
+    }
+
+    std::string_view bytes(static_cast<const char*>(data), size);
+    size_t hash = std::hash<std::string_view>()(bytes) + static_cast<size_t>(kind);
+    auto range = entries_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.kind == kind && it->second.bytes == bytes) {
+            return it->second.value.Get(isolate);
+        }
+    }
+
+    if (entries_.size() >= max_distinct_) {
+        entries_.clear();
+        enabled_ = false;
+        return MaybeLocal<String>();
+    }
+
+    MaybeLocal<String> value;
+    int length = static_cast<int>(size);
+    switch (kind) {
+    case Kind::Utf8:
+        value = String::NewFromUtf8(isolate, bytes.data(), NewStringType::kInternalized, length);
+        break;
+    case Kind::Utf16:
+        value = String::NewFromTwoByte(isolate, reinterpret_cast<const uint16_t*>(bytes.data()),
+                                       NewStringType::kInternalized, length / 2);
+        break;
+    case Kind::Latin1:
+        value = String::NewFromOneByte(isolate, reinterpret_cast<const uint8_t*>(bytes.data()),
+                                       NewStringType::kInternalized, length);
+        break;
+    }
+
+    Local<String> str;
+    if (value.ToLocal(&str)) {
+        entries_.emplace(hash, Entry{kind, std::string(bytes), v8::Global<String>(isolate, str)});
+    }
+    return value;
+}
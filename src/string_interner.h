@@ -0,0 +1,41 @@
+#pragma once
+
+#include <v8.h>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+// Hands out one string per distinct text value of a column.
+//
+// Values are looked up by their bytes as read from SQLite, so a hit creates
+// no string at all. The strings are internalized, which makes comparing
+// them with literals and property names a pointer comparison. Once a
+// column shows more than `max_distinct` values the interner drops what it
+// holds and gives up on that column for good.
+class StringInterner {
+public:
+    // How the bytes of a value encode its text
+    enum class Kind {
+        Utf8,
+        Utf16,
+        Latin1
+    };
+
+    explicit StringInterner(size_t max_distinct) : max_distinct_(max_distinct), enabled_(true) {}
+
+    // Returns the string for `size` bytes at `data`, or an empty handle if
+    // the value is too long to be worth caching or the column has turned
+    // out to be high-cardinality.
+    v8::MaybeLocal<v8::String> Get(v8::Isolate* isolate, const void* data, size_t size, Kind kind);
+
+private:
+    struct Entry {
+        Kind kind;
+        std::string bytes;
+        v8::Global<v8::String> value;
+    };
+
+    std::unordered_multimap<size_t, Entry> entries_;
+    size_t max_distinct_;
+    bool enabled_;
+};
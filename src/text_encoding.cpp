@@ -0,0 +1,64 @@
+#include "text_encoding.h"
+#include "simd_text.h"
+
+using v8::Isolate;
+using v8::Local;
+using v8::NewStringType;
+using v8::String;
+
+StagedText StageUtf16(RowArena& arena, const uint16_t* data, size_t length) {
+    StagedText text;
+    if (IsLatin1(data, length)) {
+        uint8_t* copy = static_cast<uint8_t*>(arena.Allocate(length, &text.slab));
+        NarrowLatin1(data, length, copy);
+        text.data = copy;
+        text.one_byte = true;
+    } else {
+        text.data = arena.Copy(data, length, &text.slab);
+        text.one_byte = false;
+    }
+    return text;
+}
+
+Local<String> NewStagedString(Isolate* isolate, const StagedText& text, size_t length) {
+    if (text.one_byte) {
+        return NewSlabOneByteString(isolate, static_cast<const uint8_t*>(text.data), length, text.slab);
+    }
+    return NewSlabString(isolate, static_cast<const uint16_t*>(text.data), length, text.slab);
+}
+
+Local<String> NewUtf8String(Isolate* isolate, const char* data, size_t length, RowArena& arena) {
+    if (length == 0) {
+        return String::Empty(isolate);
+    }
+    if (IsAscii(data, length)) {
+        return String::NewFromOneByte(isolate, reinterpret_cast<const uint8_t*>(data), NewStringType::kNormal,
+                                      static_cast<int>(length)).ToLocalChecked();
+    }
+    if (length < kMinExternalStringLength) {
+        return String::NewFromUtf8(isolate, data, NewStringType::kNormal, static_cast<int>(length)).ToLocalChecked();
+    }
+
+    // Every byte decodes to at most one code unit; the slab gets back what
+    // the text doesn't need
+    TextSlab* slab;
+    uint16_t* utf16 = static_cast<uint16_t*>(arena.Allocate(length * sizeof(uint16_t), &slab));
+    size_t units = Utf8ToUtf16(data, length, utf16);
+    if (IsLatin1(utf16, units)) {
+        // Narrowing in place only ever writes behind what it still reads
+        uint8_t* latin1 = reinterpret_cast<uint8_t*>(utf16);
+        NarrowLatin1(utf16, units, latin1);
+        slab->Shrink(length * sizeof(uint16_t) - units);
+        return NewSlabOneByteString(isolate, latin1, units, slab);
+    }
+    slab->Shrink((length - units) * sizeof(uint16_t));
+    return NewSlabString(isolate, utf16, units, slab);
+}
+
+Local<String> NewUtf16String(Isolate* isolate, const uint16_t* data, size_t length, RowArena& arena) {
+    if (length < kMinExternalStringLength) {
+        // V8 already stores two-byte input that fits Latin-1 as one-byte
+        return String::NewFromTwoByte(isolate, data, NewStringType::kNormal, static_cast<int>(length)).ToLocalChecked();
+    }
+    return NewStagedString(isolate, StageUtf16(arena, data, length), length);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <v8.h>
+#include <cstddef>
+#include <cstdint>
+#include "external_string.h"
+
+// How a connection stores text, as reported by PRAGMA encoding. Reading
+// and binding text in the stored encoding saves SQLite a conversion per
+// value.
+enum class TextEncoding {
+    Utf8,
+    Utf16
+};
+
+// UTF-16 text copied into a row arena, narrowed to one byte per character
+// when it fits Latin-1
+struct StagedText {
+    const void* data;
+    TextSlab* slab;
+    bool one_byte;
+};
+
+// Stages `length` code units of UTF-16 text; safe off the main thread
+StagedText StageUtf16(RowArena& arena, const uint16_t* data, size_t length);
+
+// Creates the string for staged text, taking over its slab reference
+v8::Local<v8::String> NewStagedString(v8::Isolate* isolate, const StagedText& text, size_t length);
+
+// Creates a string from UTF-8 column text. ASCII is copied as one-byte text
+// without going through V8's UTF-8 decoder; long non-ASCII text is decoded
+// into `arena` and becomes an external string.
+v8::Local<v8::String> NewUtf8String(v8::Isolate* isolate, const char* data, size_t length, RowArena& arena);
+
+// Creates a string from UTF-16 column text. Long text becomes an external
+// string in `arena`, with one byte per character when it fits Latin-1.
+v8::Local<v8::String> NewUtf16String(v8::Isolate* isolate, const uint16_t* data, size_t length, RowArena& arena);
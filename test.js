@@ -0,0 +1,937 @@
+const assert = require("assert");
+const fs = require("fs");
+const os = require("os");
+const path = require("path");
+const v8 = require("v8");
+const vm = require("vm");
+const { test } = require("node:test");
+const { spawnSync } = require("child_process");
+const { Worker } = require("worker_threads");
+const { Database, Pool } = require("./index.js");
+
+v8.setFlagsFromString("--expose-gc");
+const gc = vm.runInNewContext("gc");
+
+const tmpDir = fs.mkdtempSync(path.join(os.tmpdir(), "mo-betta-test-"));
+process.on("exit", () => fs.rmSync(tmpDir, { recursive: true, force: true }));
+
+// Records that only parse right if chunk boundaries follow the quoting:
+// line breaks inside quoted fields, and quotes inside unquoted ones
+function quotingCsv(records, newline) {
+	const parts = ["id,note" + newline];
+	const expected = [];
+	for (let i = 0; i < records; i++) {
+		if (i % 1000 === 0) {
+			parts.push(`${i},5" screen${newline}`);
+			expected.push('5" screen');
+		} else {
+			parts.push(`${i},"line one${newline}line ""two"" ${i}"${newline}`);
+			expected.push(`line one${newline}line "two" ${i}`);
+		}
+	}
+	return { csv: parts.join(""), expected };
+}
+
+async function importAndCheck(file, expected, options) {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t(id INTEGER, note TEXT)");
+	assert.strictEqual(await db.importCsv(file, "t", options), expected.length);
+	const rows = db.prepare("SELECT id, note FROM t ORDER BY rowid").all();
+	assert.strictEqual(rows.length, expected.length);
+	rows.forEach((row, i) => {
+		assert.strictEqual(row.id, i);
+		assert.strictEqual(row.note, expected[i]);
+	});
+	db.close();
+}
+
+test("importCsv splits files larger than a chunk along quoted fields", async () => {
+	const { csv, expected } = quotingCsv(300_000, "\n");
+	const file = path.join(tmpDir, "quoting.csv");
+	fs.writeFileSync(file, csv);
+	assert.ok(csv.length > 4 << 20);
+	for (const threads of [1, 4]) {
+		await importAndCheck(file, expected, { threads });
+	}
+});
+
+test("importCsv splits files with CR line endings", async () => {
+	const { csv, expected } = quotingCsv(300_000, "\r");
+	const file = path.join(tmpDir, "cr.csv");
+	fs.writeFileSync(file, csv);
+	await importAndCheck(file, expected, { threads: 4 });
+});
+
+test("transaction functions keep running synchronous calls after async ones", async () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t(x)");
+	const ins = db.prepare("INSERT INTO t VALUES (?)");
+	let pending;
+	db.transaction(() => {
+		ins.run(1);
+		pending = db.execAsync("INSERT INTO t VALUES (3)");
+		ins.run(2);
+		assert.throws(() => db.close(), /busy/);
+	})();
+	assert.throws(() => ins.run(4), /busy/);
+	await pending;
+	assert.deepStrictEqual(db.prepare("SELECT x FROM t").all().map((row) => row.x), [1, 2, 3]);
+	db.close();
+});
+
+test("CSV exports keep empty text apart from NULL", async () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE a(a, b); INSERT INTO a VALUES ('', 'x'), (NULL, 'y'); CREATE TABLE b(a, b)");
+	const file = path.join(tmpDir, "empty.csv");
+	db.prepare("SELECT * FROM a").exportTo(file);
+	assert.strictEqual(fs.readFileSync(file, "utf8"), 'a,b\n"",x\n,y\n');
+	await db.importCsv(file, "b");
+	assert.deepStrictEqual(db.prepare("SELECT a, b FROM b").all(), [{ a: "", b: "x" }, { a: null, b: "y" }]);
+	db.close();
+});
+
+test("getInt throws instead of truncating 64-bit integers", () => {
+	const db = new Database(":memory:");
+	const stmt = db.prepare("SELECT 2147483647, -2147483648, 2147483648, 9007199254740993");
+	assert.ok(stmt.step());
+	assert.strictEqual(stmt.getInt(0), 2147483647);
+	assert.strictEqual(stmt.getInt(1), -2147483648);
+	assert.throws(() => stmt.getInt(2), RangeError);
+	assert.throws(() => stmt.getInt(3), RangeError);
+	db.close();
+});
+
+test("statements bind positional and named parameters", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, score REAL, data BLOB)");
+	const insert = db.prepare("INSERT INTO t(name, score, data) VALUES (?, ?, ?)");
+	assert.deepStrictEqual(insert.run("a", 1.5, Buffer.from([1, 2])), { changes: 1, lastInsertRowid: 1 });
+	insert.run(["b", 2, null]);
+	db.prepare("INSERT INTO t(name, score) VALUES (:name, @score)").run({ name: "c", score: 3 });
+
+	const byId = db.prepare("SELECT name, score FROM t WHERE id = ?");
+	assert.deepStrictEqual(byId.get([2]), { name: "b", score: 2 });
+	assert.strictEqual(byId.get([9]), undefined);
+	assert.deepStrictEqual(db.prepare("SELECT data FROM t WHERE id = 1").all(), [{ data: Buffer.from([1, 2]) }]);
+	assert.deepStrictEqual(db.prepare("SELECT name FROM t WHERE score > ?").all(1.5).map((row) => row.name), ["b", "c"]);
+
+	// bind() keeps the values for later calls without parameters
+	byId.bind(3);
+	assert.deepStrictEqual(byId.all(), [{ name: "c", score: 3 }]);
+	assert.throws(() => insert.run("x", 1, null, "extra"), RangeError);
+	db.close();
+});
+
+test("get() reads a column for numbers and strings and binds only arrays and objects", () => {
+	const db = new Database(":memory:");
+	const stmt = db.prepare("SELECT ? AS a, 'b' AS b, 'c' AS c, 'd' AS d, 'e' AS e, 'f' AS f");
+	assert.deepStrictEqual(stmt.get([5]), { a: 5, b: "b", c: "c", d: "d", e: "e", f: "f" });
+	// The row stepped by get([5]) is still current
+	assert.strictEqual(stmt.get(5), "f");
+	assert.strictEqual(stmt.get("a"), 5);
+	assert.throws(() => stmt.get(6), RangeError);
+	assert.throws(() => stmt.get(true), TypeError);
+	assert.throws(() => stmt.get(), TypeError);
+	db.close();
+});
+
+test("text read from a row stays valid after later steps and finalize", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t(s TEXT)");
+	const insert = db.prepare("INSERT INTO t VALUES (?)");
+	for (let i = 0; i < 2000; i++) {
+		insert.run(`value ${i} `.repeat(8));
+	}
+	const stmt = db.prepare("SELECT s FROM t");
+	const kept = [];
+	while (stmt.step()) {
+		kept.push(stmt.get(0));
+	}
+	const rows = db.prepare("SELECT s FROM t").all();
+	stmt.finalize();
+	db.close();
+	kept.forEach((s, i) => assert.strictEqual(s, `value ${i} `.repeat(8)));
+	rows.forEach((row, i) => assert.strictEqual(row.s, `value ${i} `.repeat(8)));
+});
+
+test("rows are objects keyed by column name, duplicates keeping the last value", () => {
+	const db = new Database(":memory:");
+	const stmt = db.prepare("SELECT 1 AS a, 'x' AS b, NULL AS c, 2 AS a");
+	const [row] = stmt.all();
+	assert.deepStrictEqual(Object.keys(row), ["a", "b", "c"]);
+	assert.deepStrictEqual(row, { a: 2, b: "x", c: null });
+	// The shape is reused: a second call builds an equal, separate object
+	const [again] = stmt.all();
+	assert.notStrictEqual(again, row);
+	assert.deepStrictEqual(again, row);
+	db.close();
+});
+
+test("raw mode returns rows as arrays in column order", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t(a, b); INSERT INTO t VALUES (1, 'x'), (2, NULL)");
+	const stmt = db.prepare("SELECT a, b, a FROM t ORDER BY a");
+	assert.strictEqual(stmt.raw(), stmt);
+	assert.deepStrictEqual(stmt.all(), [[1, "x", 1], [2, null, 2]]);
+	assert.deepStrictEqual([...stmt], [[1, "x", 1], [2, null, 2]]);
+	assert.deepStrictEqual(stmt.get([]), [1, "x", 1]);
+	stmt.raw(false);
+	assert.deepStrictEqual(stmt.all()[0], { a: 1, b: "x" });
+	db.close();
+});
+
+test("fetchColumns returns typed columns batch by batch", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t(i INTEGER, r REAL, s TEXT, b BLOB)");
+	const insert = db.prepare("INSERT INTO t VALUES (?, ?, ?, ?)");
+	insert.run(1, 1.5, "ab", Buffer.from([1]));
+	insert.run(null, 2, null, Buffer.from([2, 3]));
+	insert.run(3, null, "c", null);
+	const stmt = db.prepare("SELECT i, r, s, b FROM t ORDER BY rowid");
+
+	const first = stmt.fetchColumns(2);
+	assert.strictEqual(first.rowCount, 2);
+	assert.strictEqual(first.done, false);
+	const [i, r, s, b] = first.columns;
+	assert.deepStrictEqual([i.name, i.type, r.type, s.type, b.type], ["i", "integer", "real", "text", "blob"]);
+	assert.deepStrictEqual([...i.values], [1, 0]);
+	assert.deepStrictEqual([...i.nulls], [0b10]);
+	assert.deepStrictEqual([...r.values], [1.5, 2]);
+	assert.deepStrictEqual([...s.offsets], [0, 2, 2]);
+	assert.strictEqual(s.data.toString(), "ab");
+	assert.deepStrictEqual([...b.offsets], [0, 1, 3]);
+
+	const rest = stmt.fetchColumns(10, { bigint: true });
+	assert.strictEqual(rest.rowCount, 1);
+	assert.strictEqual(rest.done, true);
+	assert.deepStrictEqual([...rest.columns[0].values], [3n]);
+	assert.deepStrictEqual([...rest.columns[1].nulls], [1]);
+	db.close();
+});
+
+test("fetchColumns types untyped columns by their first non-NULL value and rejects lossy values", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t(n INTEGER, v); INSERT INTO t VALUES (1, NULL), (2, 'x'), (3, 'y')");
+	const { columns } = db.prepare("SELECT v FROM t ORDER BY n").fetchColumns();
+	assert.strictEqual(columns[0].type, "text");
+	assert.deepStrictEqual([...columns[0].offsets], [0, 0, 1, 2]);
+	assert.deepStrictEqual([...columns[0].nulls], [1]);
+
+	// Integers widen into a real column
+	const real = db.prepare("SELECT CASE n WHEN 1 THEN 0.5 ELSE n END FROM t ORDER BY n").fetchColumns();
+	assert.deepStrictEqual([...real.columns[0].values], [0.5, 2, 3]);
+
+	db.exec("INSERT INTO t VALUES ('text in an integer column', NULL)");
+	assert.throws(() => db.prepare("SELECT n FROM t").fetchColumns(), {
+		name: "TypeError",
+		message: /Column "n" holds a text value/,
+	});
+	assert.throws(() => db.prepare("SELECT CASE n WHEN 1 THEN 1 ELSE 'x' END FROM t").fetchColumns(), TypeError);
+	db.close();
+});
+
+test("nextBatch and iteration step rows in batches and reset when stopped early", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t(n)");
+	db.prepare("INSERT INTO t VALUES (?)").runMany(Array.from({ length: 100 }, (_, i) => [i]));
+	const stmt = db.prepare("SELECT n FROM t ORDER BY n");
+
+	assert.deepStrictEqual(stmt.nextBatch(3).map((row) => row.n), [0, 1, 2]);
+	assert.strictEqual(stmt.nextBatch(1000).length, 97);
+	// The short batch reset the statement, so it starts over
+	assert.strictEqual(stmt.nextBatch(1)[0].n, 0);
+	stmt.reset();
+
+	assert.deepStrictEqual([...stmt].map((row) => row.n), Array.from({ length: 100 }, (_, i) => i));
+	for (const row of stmt) {
+		if (row.n === 40) {
+			break;
+		}
+	}
+	assert.strictEqual(stmt.next().value.n, 0);
+	db.close();
+});
+
+// Keeps a connection on the threadpool for a while
+const SLOW_QUERY = "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 2000000) SELECT sum(x) AS total FROM c";
+
+function runWorker(source) {
+	const worker = new Worker(source, { eval: true, workerData: require.resolve("./index.js") });
+	return new Promise((resolve, reject) => {
+		worker.once("message", resolve);
+		worker.once("error", reject);
+	});
+}
+
+test("the addon loads and runs queries in several worker threads", async () => {
+	const source = `
+		const { parentPort, workerData } = require("worker_threads");
+		const { Database } = require(workerData);
+		const db = new Database(":memory:");
+		parentPort.postMessage(db.prepare("SELECT 40 + 2 AS n").all()[0].n);
+	`;
+	assert.deepStrictEqual(await Promise.all([runWorker(source), runWorker(source)]), [42, 42]);
+});
+
+test("async work keeps an unreachable database open until it finishes", async () => {
+	let pending;
+	(() => {
+		const db = new Database(":memory:");
+		pending = db.prepare(SLOW_QUERY).allAsync();
+	})();
+	gc();
+	assert.deepStrictEqual(await pending, [{ total: 2000001000000 }]);
+});
+
+test("async work runs one piece at a time in the order it was started", async () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (x INTEGER)");
+	const insert = db.prepare("INSERT INTO t VALUES (?)");
+	const select = db.prepare("SELECT x FROM t ORDER BY x");
+	const inserted = [insert.runAsync(1), insert.runAsync(2)];
+	const rows = select.allAsync();
+	const dropped = db.execAsync("DROP TABLE t");
+	assert.throws(() => db.prepare("SELECT 1"), /busy/);
+	assert.deepStrictEqual((await Promise.all(inserted)).map((result) => result.changes), [1, 1]);
+	assert.deepStrictEqual(await rows, [{ x: 1 }, { x: 2 }]);
+	await dropped;
+	assert.throws(() => db.exec("SELECT x FROM t"), /no such table/);
+	db.close();
+});
+
+test("terminating a worker with async work in flight drops the work and closes its databases", async () => {
+	const source = `
+		const { parentPort, workerData } = require("worker_threads");
+		const { Database } = require(workerData);
+		const db = new Database(":memory:");
+		const first = db.prepare(${JSON.stringify(SLOW_QUERY)});
+		const second = db.prepare(${JSON.stringify(SLOW_QUERY)});
+		first.allAsync();
+		db.execAsync(${JSON.stringify(SLOW_QUERY)});
+		second.allAsync();
+		parentPort.postMessage("started");
+	`;
+	for (let round = 0; round < 3; round++) {
+		const worker = new Worker(source, { eval: true, workerData: require.resolve("./index.js") });
+		await new Promise((resolve) => worker.once("message", resolve));
+		await new Promise((resolve) => setTimeout(resolve, 10 * round));
+		assert.strictEqual(await worker.terminate(), 1);
+	}
+});
+
+test("a pool runs reads on its readers and writes in order on the writer", async () => {
+	const pool = new Pool(path.join(tmpDir, "pool.db"), { readers: 2 });
+	await pool.exec("CREATE TABLE t (x INTEGER)");
+	const writes = [1, 2, 3].map((x) => pool.run("INSERT INTO t VALUES (?)", x));
+	assert.deepStrictEqual((await Promise.all(writes)).map((result) => Number(result.lastInsertRowid)), [1, 2, 3]);
+	const reads = await Promise.all([pool.all("SELECT sum(x) AS total FROM t"), pool.all("SELECT count(*) AS n FROM t WHERE x > ?", 1)]);
+	assert.deepStrictEqual(reads, [[{ total: 6 }], [{ n: 2 }]]);
+	await pool.close();
+	await assert.rejects(pool.all("SELECT 1"), /closed/);
+});
+
+test("a pool that fails to open a reader closes the connections it already opened", { skip: process.platform === "win32" }, () => {
+	// Runs out of file descriptors partway through the readers; the
+	// connection opened afterwards only fits if the pool gave its own back
+	const script = `
+		const { Database, Pool } = require(process.argv[1]);
+		const file = process.argv[2];
+		try {
+			new Pool(file, { readers: 200 });
+		} catch (err) {
+			console.log(err.message);
+		}
+		const db = new Database(file);
+		console.log(db.prepare("SELECT 1 AS n").all()[0].n);
+	`;
+	const result = spawnSync("sh", ["-c", 'ulimit -n 100 && "$0" -e "$1" "$2" "$3"', process.execPath, script,
+		require.resolve("./index.js"), path.join(tmpDir, "pool-limit.db")], { encoding: "utf8" });
+	assert.strictEqual(result.stderr, "");
+	assert.strictEqual(result.stdout, "Cannot open database: unable to open database file\n1\n");
+});
+
+test("prepare() reuses finalized statements and misses while one with the same SQL is alive", () => {
+	const db = new Database(":memory:", { statementCacheSize: 2 });
+	const sql = "SELECT ? AS n";
+	const first = db.prepare(sql);
+	const second = db.prepare(sql);
+	assert.deepStrictEqual(db.cacheStats(), { hits: 0, misses: 2, size: 0, capacity: 2 });
+	first.bind(1);
+	first.finalize();
+	second.finalize();
+	assert.strictEqual(db.cacheStats().size, 2);
+	// A cached statement comes back reset, without its old bindings
+	assert.deepStrictEqual(db.prepare(sql).all(), [{ n: null }]);
+	assert.deepStrictEqual(db.cacheStats(), { hits: 1, misses: 2, size: 1, capacity: 2 });
+	for (const other of ["SELECT 1", "SELECT 2", "SELECT 3"]) {
+		db.prepare(other).finalize();
+	}
+	assert.strictEqual(db.cacheStats().size, 2);
+	db.close();
+
+	const uncached = new Database(":memory:", { statementCacheSize: 0 });
+	uncached.prepare("SELECT 1").finalize();
+	uncached.prepare("SELECT 1").finalize();
+	assert.deepStrictEqual(uncached.cacheStats(), { hits: 0, misses: 2, size: 0, capacity: 0 });
+	uncached.close();
+});
+
+test("transaction functions commit, roll back on throw and nest as savepoints", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (x INTEGER)");
+	const insert = db.prepare("INSERT INTO t VALUES (?)");
+	const values = () => db.prepare("SELECT x FROM t ORDER BY x").all().map((row) => row.x);
+
+	const insertMany = db.transaction(function (...xs) {
+		for (const x of xs) {
+			insert.run(x);
+		}
+		return this;
+	});
+	const receiver = {};
+	assert.strictEqual(insertMany.call(receiver, 1, 2), receiver);
+	assert.deepStrictEqual(values(), [1, 2]);
+
+	const failing = db.transaction(() => {
+		insert.run(3);
+		throw new Error("boom");
+	});
+	assert.throws(() => failing(), /boom/);
+	assert.deepStrictEqual(values(), [1, 2]);
+
+	// A failing inner call only rolls back its savepoint
+	db.transaction(() => {
+		insert.run(4);
+		assert.throws(() => failing(), /boom/);
+		insertMany(5);
+	})();
+	assert.deepStrictEqual(values(), [1, 2, 4, 5]);
+
+	// An outer rollback also undoes inner calls that returned
+	assert.throws(() => db.transaction(() => {
+		insertMany(6);
+		throw new Error("outer");
+	})(), /outer/);
+	assert.deepStrictEqual(values(), [1, 2, 4, 5]);
+	db.close();
+});
+
+test("immediate and exclusive transactions take their locks up front", () => {
+	const file = path.join(tmpDir, "locks.db");
+	const db = new Database(file);
+	db.exec("CREATE TABLE t (x INTEGER)");
+	const other = new Database(file);
+	const insert = db.prepare("INSERT INTO t VALUES (1)");
+	const read = other.prepare("SELECT count(*) AS n FROM t");
+	const write = other.prepare("INSERT INTO t VALUES (2)");
+
+	const insertOne = db.transaction(() => insert.run());
+	insertOne.immediate.call(null);
+	db.transaction(() => {
+		// Others can still read, but not write
+		assert.deepStrictEqual(read.all(), [{ n: 1 }]);
+		assert.throws(() => write.run(), /locked/);
+	}).immediate();
+	db.transaction(() => {
+		assert.throws(() => read.all(), /locked/);
+	}).exclusive();
+	insertOne.deferred();
+	assert.deepStrictEqual(read.all(), [{ n: 2 }]);
+	other.close();
+	db.close();
+});
+
+test("runMany runs a statement per row in one transaction and rolls back every row on failure", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT NOT NULL)");
+	const insert = db.prepare("INSERT INTO t (name) VALUES (?)");
+	const result = insert.runMany([["a"], ["b"], ["c"]]);
+	assert.strictEqual(Number(result.changes), 3);
+	assert.deepStrictEqual(result.lastInsertRowids, BigInt64Array.from([1n, 2n, 3n]));
+
+	const named = db.prepare("INSERT INTO t (id, name) VALUES ($id, $name)");
+	named.runMany([{ id: 10, name: "d" }]);
+	assert.throws(() => insert.runMany([["e"], [null], ["f"]]), /NOT NULL/);
+	assert.deepStrictEqual(db.prepare("SELECT name FROM t ORDER BY id").all().map((row) => row.name), ["a", "b", "c", "d"]);
+
+	// Inside a transaction function the rows are rolled back to a savepoint
+	db.transaction(() => {
+		insert.run("g");
+		assert.throws(() => insert.runMany([["h"], [null]]), /NOT NULL/);
+	})();
+	assert.deepStrictEqual(db.prepare("SELECT count(*) AS n FROM t").all(), [{ n: 5 }]);
+	db.close();
+});
+
+test("runColumns binds typed array and plain array columns row by row", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (a INTEGER, b REAL, c TEXT, d INTEGER)");
+	const insert = db.prepare("INSERT INTO t VALUES (?, ?, ?, ?)");
+	const result = insert.runColumns([Int32Array.of(1, 2, 3), Float64Array.of(0.5, 1.5, 2.5, 3.5), ["x", null, "z"], BigInt64Array.of(-1n, 2n ** 62n, 0n)]);
+	assert.strictEqual(Number(result.changes), 3);
+	const named = db.prepare("INSERT INTO t (a, c) VALUES ($a, $c)");
+	named.runColumns({ a: Uint8Array.of(7, 8), c: ["p", "q"] }, 1);
+	assert.deepStrictEqual(db.prepare("SELECT * FROM t").raw().all(), [
+		[1, 0.5, "x", -1],
+		[2, 1.5, null, 2n ** 62n],
+		[3, 2.5, "z", 0],
+		[7, null, "p", null],
+	]);
+	assert.throws(() => insert.runColumns([BigUint64Array.of(2n ** 63n)]), RangeError);
+	db.close();
+});
+
+test("runColumns rejects typed array columns that JS detaches or shrinks while they are read", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (a REAL, b TEXT)");
+	const insert = db.prepare("INSERT INTO t VALUES (?, ?)");
+	const count = db.prepare("SELECT count(*) AS n FROM t");
+
+	// An accessor in a plain array column
+	const numbers = new Float64Array(4).fill(1);
+	const names = ["a", "b", "c", "d"];
+	Object.defineProperty(names, 2, {
+		get() {
+			structuredClone(numbers.buffer, { transfer: [numbers.buffer] });
+			return "c";
+		},
+	});
+	assert.throws(() => insert.runColumns([numbers, names]), /detached or shrunk/);
+
+	// A resizable buffer shrunk from a Proxy on the prototype chain of a
+	// sparse array
+	const buffer = new ArrayBuffer(32, { maxByteLength: 32 });
+	const tracking = new Float64Array(buffer).fill(2);
+	const sparse = new Array(4);
+	Object.setPrototypeOf(sparse, new Proxy([], {
+		get(target, key) {
+			if (key === "1") {
+				buffer.resize(8);
+			}
+			return Reflect.get(target, key);
+		},
+	}));
+	assert.throws(() => insert.runColumns([tracking, sparse]), /detached or shrunk/);
+
+	// A getter on the columns object detaching a column read before it,
+	// which leaves that column empty
+	const detachingColumns = () => {
+		const a = new Float64Array(4).fill(3);
+		return Object.defineProperty({ a }, "b", {
+			enumerable: true,
+			get() {
+				structuredClone(a.buffer, { transfer: [a.buffer] });
+				return ["a", "b", "c", "d"];
+			},
+		});
+	};
+	const named = db.prepare("INSERT INTO t VALUES ($a, $b)");
+	assert.strictEqual(Number(named.runColumns(detachingColumns()).changes), 0);
+	assert.throws(() => named.runColumns(detachingColumns(), 4), /Row count must be/);
+
+	assert.deepStrictEqual(count.all(), [{ n: 0 }]);
+	db.close();
+});
+
+test("collected statements go back to the cache and collected databases close", async () => {
+	const db = new Database(":memory:");
+	(() => {
+		db.prepare("SELECT 1 AS n").all();
+	})();
+	gc();
+	await new Promise((resolve) => setImmediate(resolve));
+	assert.strictEqual(db.cacheStats().size, 1);
+
+	// A statement keeps its database usable after the database object is dropped
+	const statement = (() => new Database(":memory:").prepare("SELECT 2 AS n"))();
+	gc();
+	assert.deepStrictEqual(statement.all(), [{ n: 2 }]);
+
+	// Finalized statements are not released again when collected
+	(() => {
+		db.prepare("SELECT 1 AS n").finalize();
+	})();
+	gc();
+	await new Promise((resolve) => setImmediate(resolve));
+	assert.deepStrictEqual(db.cacheStats(), { hits: 1, misses: 1, size: 1, capacity: 128 });
+	db.close();
+
+	// An exclusive lock only goes away once the connection holding it is closed
+	const file = path.join(tmpDir, "collected.db");
+	(() => {
+		const holder = new Database(file);
+		holder.exec("PRAGMA locking_mode = EXCLUSIVE; CREATE TABLE t (x); INSERT INTO t VALUES (1)");
+	})();
+	assert.throws(() => new Database(file), /locked/);
+	gc();
+	await new Promise((resolve) => setImmediate(resolve));
+	const other = new Database(file);
+	assert.deepStrictEqual(other.prepare("SELECT x FROM t").all(), [{ x: 1 }]);
+	other.close();
+});
+
+test("step, reset and the typed accessors keep their results and errors in hot loops", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (i INTEGER, d REAL)");
+	const insert = db.prepare("INSERT INTO t VALUES (?, ?)");
+	const select = db.prepare("SELECT i, d FROM t WHERE i >= ?");
+	const rows = 200;
+
+	// Enough calls for the loops to be optimized, where fast calls are used
+	for (let round = 0; round < 50; round++) {
+		let sumInt = 0;
+		let sumDouble = 0;
+		for (let i = 0; i < rows; i++) {
+			insert.bindInt(1, i);
+			insert.bindDouble(2, i + 0.5);
+			insert.step();
+			insert.reset();
+		}
+		select.bindInt(1, 0);
+		while (select.step()) {
+			sumInt += select.getInt(0);
+			sumDouble += select.getDouble(1);
+		}
+		select.reset();
+		assert.strictEqual(sumInt, (round + 1) * (rows * (rows - 1)) / 2);
+		assert.strictEqual(sumDouble, (round + 1) * (rows * rows) / 2);
+	}
+
+	// Errors still surface once the callers are optimized
+	db.exec("CREATE TABLE u (x UNIQUE)");
+	const big = db.prepare("SELECT 2147483648 AS n");
+	const unique = db.prepare("INSERT INTO u VALUES (1)");
+	for (let round = 0; round < 2000; round++) {
+		assert.ok(big.step());
+		assert.throws(() => big.getInt(0), /does not fit/);
+		assert.strictEqual(big.getDouble(0), 2147483648);
+		assert.throws(() => big.getDouble(1), RangeError);
+		big.reset();
+		assert.throws(() => insert.bindInt(3, 1), RangeError);
+		assert.throws(() => insert.bindInt(1, 1.5), TypeError);
+		assert.throws(() => insert.bindDouble(0.5, 1), TypeError);
+		assert.strictEqual(unique.step(), false);
+		assert.throws(() => unique.step(), /UNIQUE/);
+		db.exec("DELETE FROM u");
+		unique.reset();
+	}
+	insert.finalize();
+	assert.throws(() => insert.step(), /finalized/);
+	db.close();
+});
+
+test("columns are found by name, the first of duplicate names winning", () => {
+	const db = new Database(":memory:");
+	const stmt = db.prepare("SELECT 1 AS id, 'x' AS name, 2.5 AS score, 'again' AS name, 'ü' AS \"größe\"");
+	assert.deepStrictEqual(stmt.columns(), ["id", "name", "score", "name", "größe"]);
+	assert.strictEqual(stmt.columnIndex("score"), 2);
+	assert.strictEqual(stmt.columnIndex("name"), 1);
+	assert.strictEqual(stmt.columnIndex("größe"), 4);
+	assert.throws(() => stmt.columnIndex("missing"), RangeError);
+	assert.ok(stmt.step());
+	assert.strictEqual(stmt.get("name"), "x");
+	assert.strictEqual(stmt.get("größe"), "ü");
+	assert.strictEqual(stmt.getDouble(stmt.columnIndex("score")), 2.5);
+	assert.throws(() => stmt.get("missing"), RangeError);
+	assert.throws(() => stmt.get("Name"), RangeError);
+	db.close();
+});
+
+const SAMPLE_TEXT = ["", "plain ascii", "café ünïcödé", "日本語のテキスト", "emoji 😀 and 𝄞", "x".repeat(5000) + "é"];
+
+test("the encoding option sets how a new file stores text, and existing files keep theirs", () => {
+	const expected = { utf8: "UTF-8", utf16: "UTF-16le", auto: "UTF-8", undefined: "UTF-16le" };
+	for (const [option, stored] of Object.entries(expected)) {
+		const file = path.join(tmpDir, `encoding-${option}.db`);
+		const encoding = option === "undefined" ? undefined : option;
+		const db = new Database(file, { encoding });
+		assert.deepStrictEqual(db.prepare("PRAGMA encoding").all(), [{ encoding: stored }]);
+		db.exec("CREATE TABLE t (s TEXT)");
+		const insert = db.prepare("INSERT INTO t VALUES (?)");
+		for (const text of SAMPLE_TEXT) {
+			insert.run(text);
+		}
+		db.close();
+
+		const reopened = new Database(file, { encoding: stored === "UTF-8" ? "utf16" : "utf8" });
+		assert.deepStrictEqual(reopened.prepare("PRAGMA encoding").all(), [{ encoding: stored }]);
+		assert.deepStrictEqual(reopened.prepare("SELECT s FROM t").all().map((row) => row.s), SAMPLE_TEXT);
+		assert.deepStrictEqual(reopened.prepare("SELECT length(s) AS n FROM t").all().map((row) => row.n),
+			SAMPLE_TEXT.map((text) => [...text].length));
+		reopened.close();
+	}
+	assert.throws(() => new Database(":memory:", { encoding: "latin1" }), /encoding/);
+});
+
+test("text converts correctly with non-ASCII characters at every position of a vector", () => {
+	const strings = [];
+	for (let length = 1; length <= 70; length++) {
+		for (let at = 0; at < length; at++) {
+			const special = ["é", "ÿ", "Ā", "中", "😀"][at % 5];
+			strings.push("a".repeat(at) + special + "b".repeat(length - at - 1));
+		}
+		strings.push("d".repeat(length));
+	}
+	for (const encoding of ["utf8", "utf16"]) {
+		const db = new Database(":memory:", { encoding });
+		db.exec("CREATE TABLE t (s TEXT)");
+		db.prepare("INSERT INTO t VALUES (?)").runMany(strings.map((text) => [text]));
+		assert.deepStrictEqual(db.prepare("SELECT s FROM t").raw().all().map((row) => row[0]), strings);
+		db.close();
+	}
+
+	// Invalid UTF-8 decodes like Buffer.toString()
+	const db = new Database(":memory:", { encoding: "utf8" });
+	const invalid = ["ff", "c3", "e282", "f09f98", "eda080", "c0af", "41" + "80".repeat(40) + "42", "61".repeat(33) + "f4908080"];
+	const decoded = db.prepare("SELECT CAST(? AS TEXT) AS s");
+	for (const hex of invalid) {
+		const bytes = Buffer.from(hex, "hex");
+		assert.strictEqual(decoded.get([bytes]).s, bytes.toString("utf8"), hex);
+	}
+	db.close();
+});
+
+test("interned text columns read the same values, also past maxDistinct", () => {
+	for (const encoding of ["utf8", "utf16"]) {
+		const db = new Database(":memory:", { encoding });
+		db.exec("CREATE TABLE t (status TEXT, note TEXT)");
+		const rows = [];
+		for (let i = 0; i < 600; i++) {
+			rows.push([["open", "closed", "ünïcode", null][i % 4], i < 300 ? `n${i % 3}` : `note ${i} ${"long ".repeat(i % 40)}`]);
+		}
+		db.prepare("INSERT INTO t VALUES (?, ?)").runMany(rows);
+		const expected = rows.map(([status, note]) => ({ status, note }));
+
+		const stmt = db.prepare("SELECT status, note FROM t");
+		assert.deepStrictEqual(stmt.intern({ maxDistinct: 8 }).all(), expected);
+		assert.deepStrictEqual([...stmt.nextBatch(10), ...stmt.nextBatch(1000)], expected);
+		assert.deepStrictEqual(stmt.intern().raw().all(), rows);
+		assert.deepStrictEqual(stmt.intern(false).raw(false).all(), expected);
+		assert.throws(() => stmt.intern({ maxDistinct: 0 }), RangeError);
+		assert.throws(() => stmt.intern({ maxDistinct: 1.5 }), RangeError);
+		stmt.finalize();
+		assert.throws(() => stmt.intern(), /finalized/);
+		db.close();
+	}
+});
+
+test("BLOB modes return copies, shared slab views or typed views", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (b BLOB)");
+	const floats = Float64Array.of(1.5, -2.25, Math.PI);
+	const values = [Buffer.from("abc"), Buffer.from(floats.buffer), Buffer.alloc(0), Buffer.alloc(100000, 7), Buffer.from([1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12])];
+	db.prepare("INSERT INTO t VALUES (?)").runMany(values.map((value) => [value]).concat([[null]]));
+	const stmt = db.prepare("SELECT b FROM t").raw();
+	const read = (mode) => stmt.blobMode(mode).all().map((row) => row[0]);
+
+	const copies = read("buffer");
+	assert.deepStrictEqual(copies.slice(0, 5), values);
+	assert.strictEqual(copies[5], null);
+	assert.ok(copies.every((value) => value === null || Buffer.isBuffer(value)));
+
+	const slab = read("slab");
+	assert.ok(slab.slice(0, 5).every(Buffer.isBuffer));
+	assert.deepStrictEqual(slab.slice(0, 5), values);
+	// Small values of one batch share an ArrayBuffer
+	assert.strictEqual(slab[0].buffer, slab[1].buffer);
+
+	const bytes = read("uint8array");
+	assert.ok(bytes.slice(0, 5).every((value) => value.constructor === Uint8Array));
+	assert.deepStrictEqual(bytes.slice(0, 5).map((value) => Buffer.from(value.buffer, value.byteOffset, value.byteLength)), values);
+
+	const doubles = read("float64array");
+	assert.deepStrictEqual(doubles[1], floats);
+	assert.strictEqual(doubles[0].constructor, Uint8Array);
+	assert.strictEqual(doubles[4].constructor, Uint8Array);
+
+	const singles = read("float32array");
+	assert.strictEqual(singles[4].constructor, Float32Array);
+	assert.strictEqual(singles[4].length, 3);
+	assert.strictEqual(singles[0].constructor, Uint8Array);
+
+	assert.throws(() => stmt.blobMode("nope"), TypeError);
+	db.close();
+});
+
+test("BLOB handles read, write and reopen incrementally, and stream in chunks", async () => {
+	const { pipeline } = require("stream/promises");
+	const { Readable } = require("stream");
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (id INTEGER PRIMARY KEY, data BLOB, other TEXT)");
+	db.exec("INSERT INTO t VALUES (1, zeroblob(200000), 'x'), (2, x'0102030405', 'y')");
+
+	const blob = db.openBlob("t", "data", 1);
+	assert.strictEqual(blob.size(), 200000);
+	blob.write(Buffer.from("hello"), 199995);
+	assert.throws(() => blob.write(Buffer.from("!"), 200000), RangeError);
+	const tail = Buffer.alloc(10);
+	assert.strictEqual(blob.read(tail, 199995), 5);
+	assert.strictEqual(tail.toString("latin1", 0, 5), "hello");
+	blob.reopen(2);
+	assert.strictEqual(blob.size(), 5);
+	const head = new Uint8Array(2);
+	blob.read(head, 3);
+	assert.deepStrictEqual([...head], [4, 5]);
+	blob.close();
+	assert.throws(() => blob.size(), Error);
+
+	const readonly = db.openBlob("t", "data", 2, { readonly: true });
+	assert.throws(() => readonly.write(Buffer.from([9])), Error);
+	// Changing the row through SQL expires the handle
+	db.exec("UPDATE t SET other = 'z' WHERE id = 2");
+	assert.throws(() => readonly.read(new Uint8Array(1)), Error);
+	readonly.close();
+
+	const source = Buffer.alloc(200000);
+	for (let i = 0; i < source.length; i++) {
+		source[i] = (i * 31) & 0xff;
+	}
+	const chunks = [];
+	for (let i = 0; i < source.length; i += 30000) {
+		chunks.push(source.subarray(i, i + 30000));
+	}
+	await pipeline(Readable.from(chunks), db.openBlob("t", "data", 1).createWriteStream());
+	const received = [];
+	await pipeline(db.openBlob("t", "data", 1, { readonly: true }).createReadStream({ start: 100, highWaterMark: 4096 }), async (stream) => {
+		for await (const chunk of stream) {
+			assert.ok(chunk.length <= 4096);
+			received.push(chunk);
+		}
+	});
+	assert.deepStrictEqual(Buffer.concat(received), source.subarray(100));
+	await assert.rejects(pipeline(Readable.from([Buffer.alloc(10)]), db.openBlob("t", "data", 1).createWriteStream({ start: 199995 })), RangeError);
+	db.close();
+});
+
+test("streams and async iteration step rows in batches between turns of the event loop", async () => {
+	const db = new Database(":memory:");
+	const stmt = db.prepare("WITH RECURSIVE c(n) AS (SELECT 0 UNION ALL SELECT n + 1 FROM c WHERE n < 999) SELECT n FROM c");
+	const expected = Array.from({ length: 1000 }, (_, n) => ({ n }));
+
+	let turns = 0;
+	const ticker = setInterval(() => turns++, 0);
+	const iterated = [];
+	for await (const row of stmt) {
+		iterated.push(row);
+	}
+	clearInterval(ticker);
+	assert.deepStrictEqual(iterated, expected);
+	assert.ok(turns > 0);
+
+	// Breaking out resets the statement
+	for await (const row of stmt) {
+		assert.deepStrictEqual(row, { n: 0 });
+		break;
+	}
+	assert.deepStrictEqual(stmt.next().value, { n: 0 });
+	stmt.reset();
+
+	const streamed = [];
+	for await (const row of stmt.stream({ batchSize: 100 })) {
+		streamed.push(row);
+	}
+	assert.deepStrictEqual(streamed, expected);
+
+	// A consumer applying backpressure only lets the stream step ahead by
+	// about its high-water mark
+	const stream = stmt.stream({ batchSize: 10 });
+	await new Promise((resolve) => stream.once("readable", resolve));
+	await new Promise((resolve) => setTimeout(resolve, 20));
+	assert.ok(stream.readableLength <= 100, `buffered ${stream.readableLength}`);
+	assert.deepStrictEqual(stream.read(), { n: 0 });
+	stream.destroy();
+	await new Promise((resolve) => stream.once("close", resolve));
+	assert.deepStrictEqual(stmt.next().value, { n: 0 });
+	db.close();
+});
+
+test("toArrow writes a framed IPC stream with one record batch per batchRows rows", () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (id INTEGER, score REAL, label TEXT, data BLOB)");
+	const rows = Array.from({ length: 10 }, (_, i) => [i * 1000003, i + 0.25, i % 3 ? `label-${i}` : null, Buffer.from([i, 255 - i])]);
+	db.prepare("INSERT INTO t VALUES (?, ?, ?, ?)").runMany(rows);
+
+	const messages = db.prepare("SELECT id, score, label, data FROM t").toArrow({ batchRows: 4 });
+	// Schema, ceil(10 / 4) record batches and the end-of-stream marker
+	assert.strictEqual(messages.length, 5);
+	assert.deepStrictEqual(messages[4], Buffer.from("ffffffff00000000", "hex"));
+	const bodies = messages.slice(0, 4).map((message) => {
+		assert.strictEqual(message.readUInt32LE(0), 0xffffffff);
+		const metadataLength = message.readInt32LE(4);
+		assert.strictEqual((8 + metadataLength) % 8, 0);
+		assert.strictEqual(message.length % 8, 0);
+		return { metadata: message.subarray(8, 8 + metadataLength), body: message.subarray(8 + metadataLength) };
+	});
+	for (const name of ["id", "score", "label", "data"]) {
+		assert.ok(bodies[0].metadata.includes(name), name);
+	}
+	assert.strictEqual(bodies[0].body.length, 0);
+
+	// Each batch body holds its rows' fixed-width values and text bytes
+	for (let batch = 0; batch < 3; batch++) {
+		const slice = rows.slice(batch * 4, batch * 4 + 4);
+		const { body } = bodies[batch + 1];
+		assert.ok(body.includes(Buffer.from(BigInt64Array.from(slice, (row) => BigInt(row[0])).buffer)));
+		assert.ok(body.includes(Buffer.from(Float64Array.from(slice, (row) => row[1]).buffer)));
+		assert.ok(body.includes(Buffer.from(slice.map((row) => row[2] ?? "").join(""))));
+		assert.ok(body.includes(Buffer.concat(slice.map((row) => row[3]))));
+	}
+
+	assert.throws(() => db.prepare("SELECT 1 AS a UNION ALL SELECT 'x'").toArrow(), TypeError);
+	assert.throws(() => db.prepare("SELECT 1").toArrow({ batchRows: 0 }), RangeError);
+	const empty = db.prepare("SELECT id FROM t WHERE 0").toArrow();
+	assert.strictEqual(empty.length, 2);
+	db.close();
+});
+
+test("exportTo writes CSV and NDJSON, a lone NULL column becoming an empty line", async () => {
+	const db = new Database(":memory:");
+	db.exec(`CREATE TABLE t (i INTEGER, r REAL, s TEXT, b BLOB);
+		INSERT INTO t VALUES (1, 0.1, 'plain', x'00ff'), (-9007199254740993, 1e300, 'has "quotes", commas
+and a newline', NULL), (NULL, NULL, '', x'')`);
+	const select = db.prepare("SELECT i, r, s, b FROM t");
+
+	const csvFile = path.join(tmpDir, "export.csv");
+	assert.strictEqual(select.exportTo(csvFile), 3);
+	assert.strictEqual(fs.readFileSync(csvFile, "utf8"),
+		"i,r,s,b\n1,0.1,plain,00ff\n-9007199254740993,1e+300,\"has \"\"quotes\"\", commas\nand a newline\",\n,,\"\",\n");
+
+	const ndjsonFile = path.join(tmpDir, "export.ndjson");
+	assert.strictEqual(await select.exportToAsync(ndjsonFile, { format: "ndjson" }), 3);
+	const lines = fs.readFileSync(ndjsonFile, "utf8").trimEnd().split("\n");
+	assert.deepStrictEqual(JSON.parse(lines[0]), { i: 1, r: 0.1, s: "plain", b: "00ff" });
+	assert.ok(lines[1].startsWith('{"i":-9007199254740993,"r":1e+300,'), lines[1]);
+	assert.deepStrictEqual(JSON.parse(lines[2]), { i: null, r: null, s: "", b: "" });
+
+	// The documented limitation: the NULL row is an empty line, which
+	// importCsv() skips
+	const single = path.join(tmpDir, "single.csv");
+	assert.strictEqual(db.prepare("SELECT s FROM t WHERE i IS NULL UNION ALL SELECT NULL").exportTo(single, { header: false }), 2);
+	assert.strictEqual(fs.readFileSync(single, "utf8"), "\"\"\n\n");
+	db.exec("CREATE TABLE back (s TEXT)");
+	assert.strictEqual(await db.importCsv(single, "back", { header: false }), 1);
+	db.close();
+});
+
+test("importCsv maps header columns, types unquoted numbers and rolls back on a bad record", async () => {
+	const db = new Database(":memory:");
+	db.exec("CREATE TABLE t (a, b, c)");
+	const file = path.join(tmpDir, "typed.csv");
+	fs.writeFileSync(file, 'c;a;b\r\n1;2.5;"3"\r\n;007;"x;y"\r\n-4;1e3;\r\n');
+	assert.strictEqual(await db.importCsv(file, "t", { delimiter: ";", threads: 2 }), 3);
+	assert.deepStrictEqual(db.prepare("SELECT a, b, c, typeof(a) AS ta, typeof(b) AS tb FROM t").all(), [
+		{ a: 2.5, b: "3", c: 1, ta: "real", tb: "text" },
+		{ a: "007", b: "x;y", c: null, ta: "text", tb: "text" },
+		{ a: "1e3", b: null, c: -4, ta: "text", tb: "null" },
+	]);
+
+	db.exec("CREATE TABLE strict (n INTEGER NOT NULL)");
+	const bad = path.join(tmpDir, "bad.csv");
+	fs.writeFileSync(bad, "1\n2\n\n3\n,\n");
+	await assert.rejects(db.importCsv(bad, "strict", { header: false }));
+	fs.writeFileSync(bad, "1\n2\n\n3\n\n");
+	assert.throws(() => db.importCsv(bad, "strict", { header: false, delimiter: "ab" }), TypeError);
+	assert.deepStrictEqual(db.prepare("SELECT count(*) AS n FROM strict").all(), [{ n: 0 }]);
+	assert.strictEqual(await db.importCsv(bad, "strict", { header: false }), 3);
+	db.close();
+});